@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../common/container.h"
+#include "../common/encode.h"
+#include "../common/options.h"
+
+using namespace std;
+
+// Benchmark of the encode and decode pipelines shared by the variants,
+// timed phase by phase. Every corpus is written to a file first, so that
+// the read and write phases go through the file system like the programs
+// do. Each corpus is encoded and decoded `warmup` times untimed and then
+// `repetitions` times timed, with every thread count asked for.
+//
+// Encode phases: read, histogram, tree (code lengths), codegen (canonical
+// codes), encode, write. Decode phases: read, parse (header and decode
+// tables), decode, write. Each phase is reported with its mean, standard
+// deviation, minimum and maximum in milliseconds and the MB/s of its mean.
+
+// A corpus file, repeated or cut to `size` unless that is 0, or a
+// synthetic corpus of kind `name`
+struct Corpus {
+    string name;
+    string fileName; // empty for a synthetic corpus
+    uint64_t size;
+};
+
+// Timings of one phase, one sample per repetition
+struct PhaseSamples {
+    string operation;
+    string phase;
+    vector<double> ms;
+};
+
+struct Result {
+    string corpus;
+    uint64_t size;
+    int threads;
+    string operation;
+    string phase;
+    double mean, stddev, min, max;
+};
+
+// Size such as 4096, 64K, 16M or 1G
+bool parseSize(const string& text, uint64_t& size) {
+    char* end;
+    size = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || text[0] == '-')
+        return false;
+    string suffix = end;
+    if (suffix == "K")
+        size <<= 10;
+    else if (suffix == "M")
+        size <<= 20;
+    else if (suffix == "G")
+        size <<= 30;
+    else if (!suffix.empty())
+        return false;
+    return size > 0;
+}
+
+// Comma separated list
+vector<string> splitList(const string& text) {
+    vector<string> items;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ','))
+        items.push_back(item);
+    return items;
+}
+
+// Synthetic corpora, the same for every run:
+//   text    words of a made-up vocabulary drawn with Zipf frequencies
+//   skewed  bytes drawn with geometrically falling frequencies
+//   random  uniformly random bytes, which do not compress
+bool generateCorpus(const string& kind, uint64_t size, vector<unsigned char>& data) {
+    mt19937_64 random(size);
+    data.resize(size);
+    if (kind == "random") {
+        for (uint64_t i = 0; i < size; ++i)
+            data[i] = static_cast<unsigned char>(random());
+    } else if (kind == "skewed") {
+        geometric_distribution<int> symbol(0.08);
+        for (uint64_t i = 0; i < size; ++i)
+            data[i] = static_cast<unsigned char>('a' + symbol(random) % 200);
+    } else if (kind == "text") {
+        vector<string> words(4096);
+        uniform_int_distribution<int> length(1, 10), letter('a', 'z');
+        for (string& word : words) {
+            for (int n = length(random); n > 0; --n)
+                word += static_cast<char>(letter(random));
+        }
+        vector<double> weights(words.size());
+        for (size_t w = 0; w < words.size(); ++w)
+            weights[w] = 1.0 / (w + 1);
+        discrete_distribution<size_t> pick(weights.begin(), weights.end());
+        uniform_int_distribution<int> lineBreak(0, 11);
+        uint64_t i = 0;
+        while (i < size) {
+            const string& word = words[pick(random)];
+            for (size_t c = 0; c < word.size() && i < size; ++c)
+                data[i++] = word[c];
+            if (i < size)
+                data[i++] = lineBreak(random) == 0 ? '\n' : ' ';
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool readFile(const string& fileName, vector<unsigned char>& data) {
+    ifstream file(fileName, ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, ios::end);
+    data.resize(file.tellg());
+    file.seekg(0);
+    return file.read(reinterpret_cast<char*>(data.data()), data.size()) || data.empty();
+}
+
+bool writeFile(const string& fileName, const unsigned char* data, size_t size) {
+    ofstream file(fileName, ios::binary);
+    return file.write(reinterpret_cast<const char*>(data), size) && file.flush();
+}
+
+// Contents of a corpus
+bool loadCorpus(const Corpus& corpus, vector<unsigned char>& data) {
+    if (corpus.fileName.empty())
+        return generateCorpus(corpus.name, corpus.size, data);
+    vector<unsigned char> contents;
+    if (!readFile(corpus.fileName, contents) || contents.empty())
+        return false;
+    if (corpus.size == 0) {
+        data.swap(contents);
+        return true;
+    }
+    data.resize(corpus.size);
+    for (uint64_t i = 0; i < corpus.size; i += contents.size())
+        memcpy(data.data() + i, contents.data(), min<uint64_t>(contents.size(), corpus.size - i));
+    return true;
+}
+
+// Times consecutive phases of one run
+class PhaseClock {
+public:
+    explicit PhaseClock(vector<PhaseSamples>* samples) : samples(samples), phase(0), last(now()) {}
+
+    // End the next phase; samples are dropped while warming up
+    void lap(const char* operation, const char* name) {
+        chrono::steady_clock::time_point time = now();
+        if (samples != nullptr) {
+            if (samples->size() <= phase)
+                samples->push_back(PhaseSamples{operation, name, vector<double>()});
+            (*samples)[phase].ms.push_back(chrono::duration<double, milli>(time - last).count());
+        }
+        phase++;
+        last = now();
+    }
+
+private:
+    static chrono::steady_clock::time_point now() { return chrono::steady_clock::now(); }
+
+    vector<PhaseSamples>* samples;
+    size_t phase;
+    chrono::steady_clock::time_point last;
+};
+
+// Encode inputFileName into encodedFileName
+bool encodeRun(const string& inputFileName, const string& encodedFileName, unsigned maxLength, unsigned streams,
+               PhaseClock& clock) {
+    vector<unsigned char> text;
+    if (!readFile(inputFileName, text))
+        return false;
+    clock.lap("encode", "read");
+
+    ContainerHeader header;
+    header.setStreams(streams);
+    header.inputSize = text.size();
+    vector<Histogram> histograms = countBlockHistograms(text.data(), text.size(), header.blockSize);
+    Histogram histogram = totalHistogram(histograms);
+    clock.lap("encode", "histogram");
+
+    header.lengths = huffmanCodeLengths(histogram, maxLength);
+    clock.lap("encode", "tree");
+
+    vector<CodeTable> codes(1);
+    canonicalCodes(header.lengths, codes[0]);
+    clock.lap("encode", "codegen");
+
+    header.blockOffsets.assign(header.indexSize(), 0);
+    vector<unsigned char> data;
+    unsigned char carry = 0;
+    encodeBlockRange(text.data(), codes, histograms, header, 0, carry, data);
+    if (header.bitCount % 8 != 0)
+        data.push_back(carry);
+    clock.lap("encode", "encode");
+
+    ofstream encodedFile(encodedFileName, ios::binary);
+    writeHeader(encodedFile, header);
+    encodedFile.write(reinterpret_cast<const char*>(data.data()), data.size());
+    encodedFile.close();
+    clock.lap("encode", "write");
+    return !encodedFile.fail();
+}
+
+// Decode encodedFileName into decodedFileName
+bool decodeRun(const string& encodedFileName, const string& decodedFileName, PhaseClock& clock) {
+    vector<unsigned char> file;
+    if (!readFile(encodedFileName, file))
+        return false;
+    clock.lap("decode", "read");
+
+    ContainerHeader header;
+    DecodeTables tables;
+    if (!parseHeader(file.data(), file.size(), header) || !buildDecodeTables(header, tables))
+        return false;
+    clock.lap("decode", "parse");
+
+    vector<unsigned char> text(header.inputSize);
+    const unsigned char* data = file.data() + header.dataOffset();
+    int64_t blockCount = header.blockCount();
+    bool valid = true;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) reduction(&& : valid)
+#endif
+    for (int64_t b = 0; b < blockCount; ++b)
+        valid = decodeBlocks(header, tables, data, header.dataSize(), 0, b, b + 1,
+                             text.data() + header.blockBegin(b)) && valid;
+    if (!valid)
+        return false;
+    clock.lap("decode", "decode");
+
+    bool written = writeFile(decodedFileName, text.data(), text.size());
+    clock.lap("decode", "write");
+    return written;
+}
+
+void summarize(const vector<PhaseSamples>& samples, const string& corpus, uint64_t size, int threads,
+               vector<Result>& results) {
+    for (const PhaseSamples& phase : samples) {
+        Result result = {corpus, size, threads, phase.operation, phase.phase, 0, 0, 0, 0};
+        const vector<double>& ms = phase.ms;
+        for (double sample : ms)
+            result.mean += sample;
+        result.mean /= ms.size();
+        for (double sample : ms)
+            result.stddev += (sample - result.mean) * (sample - result.mean);
+        result.stddev = ms.size() > 1 ? sqrt(result.stddev / (ms.size() - 1)) : 0;
+        result.min = *min_element(ms.begin(), ms.end());
+        result.max = *max_element(ms.begin(), ms.end());
+        results.push_back(result);
+    }
+}
+
+double megabytesPerSecond(const Result& result) {
+    return result.mean > 0 ? result.size / (result.mean * 1e3) : 0;
+}
+
+void writeCsv(ostream& out, const vector<Result>& results) {
+    out << "corpus,size,threads,operation,phase,mean_ms,stddev_ms,min_ms,max_ms,mb_per_s" << endl;
+    out << fixed << setprecision(3);
+    for (const Result& r : results) {
+        out << r.corpus << "," << r.size << "," << r.threads << "," << r.operation << "," << r.phase << ","
+            << r.mean << "," << r.stddev << "," << r.min << "," << r.max << "," << megabytesPerSecond(r) << endl;
+    }
+}
+
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void writeJson(ostream& out, const vector<Result>& results) {
+    out << "[" << endl << fixed << setprecision(3);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "  {\"corpus\": " << jsonString(r.corpus) << ", \"size\": " << r.size << ", \"threads\": "
+            << r.threads << ", \"operation\": " << jsonString(r.operation) << ", \"phase\": "
+            << jsonString(r.phase) << ", \"mean_ms\": " << r.mean << ", \"stddev_ms\": " << r.stddev
+            << ", \"min_ms\": " << r.min << ", \"max_ms\": " << r.max << ", \"mb_per_s\": "
+            << megabytesPerSecond(r) << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    uint64_t warmup, repetitions, maxLength, streams;
+    if (!options.parse(argc, argv, {"sizes", "synthetic", "threads", "warmup", "repetitions", "max-code-length",
+                                    "interleave", "dir", "csv", "json"}) ||
+        !options.number("warmup", 1, warmup) || !options.number("repetitions", 5, repetitions) ||
+        repetitions < 1 || !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS) {
+        cerr << "Usage: " << argv[0] << " [--sizes=1M,16M] [--synthetic=text,skewed,random] [--threads=1,4]"
+             << endl;
+        cerr << "       [--warmup=W] [--repetitions=R] [--max-code-length=L] [--interleave=S]" << endl;
+        cerr << "       [--dir=DIR] [--csv=FILE] [--json=FILE] [corpus_file ...]" << endl;
+        cerr << "       corpus files are repeated or cut to each size when --sizes is given" << endl;
+        return 1;
+    }
+
+    // Thread counts to run with; one without OpenMP
+    vector<int> threadCounts;
+#ifdef _OPENMP
+    int maxThreads = omp_get_max_threads();
+    vector<string> threadList = splitList(options.value("threads", maxThreads > 1 ? "1," + to_string(maxThreads)
+                                                                                  : "1"));
+    for (const string& item : threadList) {
+        int threads = atoi(item.c_str());
+        if (threads < 1) {
+            cerr << "Error: Invalid thread count: " << item << endl;
+            return 1;
+        }
+        threadCounts.push_back(threads);
+    }
+#else
+    threadCounts.push_back(1);
+#endif
+
+    vector<uint64_t> sizes;
+    for (const string& item : splitList(options.value("sizes"))) {
+        uint64_t size;
+        if (!parseSize(item, size)) {
+            cerr << "Error: Invalid size: " << item << endl;
+            return 1;
+        }
+        sizes.push_back(size);
+    }
+
+    // Corpora: the files given at their own size or cut to each size, and
+    // the synthetic ones, 16 MiB unless sizes are given
+    vector<Corpus> corpora;
+    for (const string& fileName : options.arguments()) {
+        string name = fileName.substr(fileName.find_last_of('/') + 1);
+        for (uint64_t size : sizes.empty() ? vector<uint64_t>(1, 0) : sizes)
+            corpora.push_back(Corpus{name, fileName, size});
+    }
+    string synthetic = options.value("synthetic", options.arguments().empty() ? "text,skewed,random" : "");
+    for (const string& kind : splitList(synthetic)) {
+        for (uint64_t size : sizes.empty() ? vector<uint64_t>(1, 16 << 20) : sizes)
+            corpora.push_back(Corpus{kind, "", size});
+    }
+
+    string dir = options.value("dir", ".");
+    string inputFileName = dir + "/bench_input.tmp";
+    string encodedFileName = dir + "/bench_encoded.tmp";
+    string decodedFileName = dir + "/bench_decoded.tmp";
+
+    vector<Result> results;
+    for (const Corpus& corpus : corpora) {
+        vector<unsigned char> input;
+        if (!loadCorpus(corpus, input)) {
+            cerr << "Error: Unable to load corpus: " << (corpus.fileName.empty() ? corpus.name : corpus.fileName)
+                 << endl;
+            return 1;
+        }
+        if (!writeFile(inputFileName, input.data(), input.size())) {
+            cerr << "Error: Unable to write file: " << inputFileName << endl;
+            return 1;
+        }
+        for (int threads : threadCounts) {
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#endif
+            vector<PhaseSamples> samples;
+            for (uint64_t run = 0; run < warmup + repetitions; ++run) {
+                PhaseClock clock(run < warmup ? nullptr : &samples);
+                vector<unsigned char> decoded;
+                if (!encodeRun(inputFileName, encodedFileName, static_cast<unsigned>(maxLength),
+                               static_cast<unsigned>(streams), clock) ||
+                    !decodeRun(encodedFileName, decodedFileName, clock) || !readFile(decodedFileName, decoded) ||
+                    decoded != input) {
+                    cerr << "Error: Round trip failed for corpus: " << corpus.name << endl;
+                    return 1;
+                }
+            }
+            summarize(samples, corpus.name, input.size(), threads, results);
+        }
+    }
+    remove(inputFileName.c_str());
+    remove(encodedFileName.c_str());
+    remove(decodedFileName.c_str());
+
+    if (options.has("csv")) {
+        ofstream csv(options.value("csv"));
+        writeCsv(csv, results);
+    }
+    if (options.has("json")) {
+        ofstream json(options.value("json"));
+        writeJson(json, results);
+    }
+    if (!options.has("csv") && !options.has("json"))
+        writeCsv(cout, results);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/codec.h"
+#include "../common/mapped_file.h"
+#include "../common/options.h"
+
+using namespace std;
+
+// Per-call latency of the in-memory codec on small payloads, the way a
+// service compresses one request at a time. Payloads of 4, 16 and 64 KiB
+// are cut from consecutive places in the input, and one Codec compresses
+// and decompresses each of them in turn, so its tables and buffers are
+// reused from call to call. Every payload is checked after decoding. With
+// --codebook the Codec codes with a trained codebook instead.
+
+int main(int argc, char* argv[]) {
+    Options options;
+    uint64_t repetitions, tableCount, maxLength, streams;
+    if (!options.parse(argc, argv, {"repetitions", "tables", "max-code-length", "interleave", "codebook"}) ||
+        options.arguments().size() != 1 || !options.number("repetitions", 1000, repetitions) || repetitions < 1 ||
+        !options.number("tables", 1, tableCount) || tableCount < 1 || tableCount > MAX_CODE_TABLES ||
+        !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS) {
+        cerr << "Usage: " << argv[0] << " [--repetitions=R] [--tables=N] [--max-code-length=L] [--interleave=S]"
+             << " [--codebook=FILE] <input_file>" << endl;
+        return 1;
+    }
+
+    string inputFileName = options.arguments()[0];
+    MappedFile input;
+    if (!input.open(inputFileName)) {
+        cerr << "Error: Unable to open input file: " << inputFileName << endl;
+        return 1;
+    }
+
+    CodecOptions codecOptions;
+    codecOptions.tables = static_cast<unsigned>(tableCount);
+    codecOptions.maxCodeLength = static_cast<unsigned>(maxLength);
+    codecOptions.streams = static_cast<unsigned>(streams);
+    Codec codec(codecOptions);
+    if (options.has("codebook")) {
+        Codebook codebook;
+        if (!readCodebook(options.value("codebook"), codebook)) {
+            cerr << "Error: Invalid codebook file: " << options.value("codebook") << endl;
+            return 1;
+        }
+        codec.setCodebook(codebook);
+    }
+
+    cout << "size,compress_us,decompress_us,ratio" << endl;
+    const size_t sizes[] = {4 << 10, 16 << 10, 64 << 10};
+    for (size_t size : sizes) {
+        if (input.size() < size) {
+            cerr << "Error: Input file is smaller than " << size << " bytes: " << inputFileName << endl;
+            return 1;
+        }
+        size_t payloads = input.size() / size;
+        vector<unsigned char> container, decoded;
+        double compressSeconds = 0, decompressSeconds = 0;
+        uint64_t encodedBytes = 0;
+        for (uint64_t r = 0; r < repetitions; ++r) {
+            const unsigned char* payload = input.data() + (r % payloads) * size;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            codec.compress(payload, size, container);
+            chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+            bool valid = codec.decompress(container.data(), container.size(), decoded);
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            if (!valid || decoded.size() != size || memcmp(decoded.data(), payload, size) != 0) {
+                cerr << "Error: Decoded payload differs at " << size << " bytes" << endl;
+                return 1;
+            }
+            compressSeconds += chrono::duration<double>(middle - start).count();
+            decompressSeconds += chrono::duration<double>(end - middle).count();
+            encodedBytes += container.size();
+        }
+        cout << size << "," << fixed << setprecision(1) << compressSeconds / repetitions * 1e6 << ","
+             << decompressSeconds / repetitions * 1e6 << "," << setprecision(3)
+             << static_cast<double>(encodedBytes) / (size * repetitions) << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../common/container.h"
+#include "../common/encode.h"
+#include "../common/mapped_file.h"
+#include "../common/options.h"
+
+using namespace std;
+
+// Decode throughput of one input coded with 1, 2, 4 and 8 streams per
+// block. Each container is encoded in memory, then every block is decoded
+// on one thread, and with OpenMP also with the blocks spread over the
+// threads. The best of the repetitions is reported, after checking that
+// the output matches the input.
+
+// Seconds taken by the fastest of `repetitions` runs of decoding every
+// block, or a negative number if decoding fails
+double timeDecode(const ContainerHeader& header, const DecodeTables& tables, const unsigned char* data,
+                  vector<unsigned char>& out, bool parallel, int repetitions) {
+    int64_t blockCount = header.blockCount();
+    double best = -1;
+    for (int r = 0; r < repetitions; ++r) {
+        bool valid = true;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (parallel) {
+#ifdef _OPENMP
+            #pragma omp parallel for schedule(dynamic) reduction(&& : valid)
+#endif
+            for (int64_t b = 0; b < blockCount; ++b)
+                valid = decodeBlocks(header, tables, data, header.dataSize(), 0, b, b + 1,
+                                     out.data() + header.blockBegin(b)) && valid;
+        } else {
+            valid = decodeBlocks(header, tables, data, header.dataSize(), 0, 0, blockCount, out.data());
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (!valid)
+            return -1;
+        if (best < 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    uint64_t repetitions, maxLength;
+    if (!options.parse(argc, argv, {"repetitions", "max-code-length"}) || options.arguments().size() != 1 ||
+        !options.number("repetitions", 5, repetitions) || repetitions < 1 ||
+        !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT) {
+        cerr << "Usage: " << argv[0] << " [--repetitions=R] [--max-code-length=L] <input_file>" << endl;
+        return 1;
+    }
+
+    string inputFileName = options.arguments()[0];
+    MappedFile input;
+    if (!input.open(inputFileName)) {
+        cerr << "Error: Unable to open input file: " << inputFileName << endl;
+        return 1;
+    }
+    if (input.size() == 0) {
+        cerr << "Error: Input file is empty: " << inputFileName << endl;
+        return 1;
+    }
+
+    Histogram histogram = {};
+    countBytes(input.data(), input.size(), histogram.data());
+    vector<CodeTable> codes(1);
+    CodeLengths lengths = huffmanCodeLengths(histogram, maxLength);
+    canonicalCodes(lengths, codes[0]);
+
+    cout << "streams,threads,MB/s" << endl;
+    const unsigned streamCounts[] = {1, 2, 4, 8};
+    for (unsigned streams : streamCounts) {
+        ContainerHeader header;
+        header.lengths = lengths;
+        header.setStreams(streams);
+        stringstream encoded;
+        encodeContainer(input.data(), input.size(), codes, header, encoded);
+        string container = encoded.str();
+
+        const unsigned char* file = reinterpret_cast<const unsigned char*>(container.data());
+        DecodeTables tables;
+        if (!parseHeader(file, container.size(), header) || !buildDecodeTables(header, tables)) {
+            cerr << "Error: Invalid container with " << streams << " streams" << endl;
+            return 1;
+        }
+
+        for (int parallel = 0; parallel < 2; ++parallel) {
+#ifndef _OPENMP
+            if (parallel)
+                break;
+#endif
+            vector<unsigned char> out(input.size());
+            double seconds = timeDecode(header, tables, file + header.dataOffset(), out, parallel != 0,
+                                        static_cast<int>(repetitions));
+            if (seconds < 0 || memcmp(out.data(), input.data(), input.size()) != 0) {
+                cerr << "Error: Decoded data differs with " << streams << " streams" << endl;
+                return 1;
+            }
+            cout << streams << "," << (parallel ? "all" : "1") << "," << fixed << setprecision(1)
+                 << input.size() / seconds / 1e6 << endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef HUFFMAN_BATCH_H
+#define HUFFMAN_BATCH_H
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+#include "mapped_file.h"
+
+// Batch mode: many files encoded or decoded by one process, each file
+// whole in memory through a Codec, so that startup, thread creation and
+// code tables are paid for once per batch rather than once per file.
+// Encoding file.txt writes file.txt.huf into the output directory and
+// decoding file.txt.huf writes file.txt there.
+
+const char BATCH_SUFFIX[] = ".huf";
+
+// A file of the batch and the file it becomes
+struct BatchFile {
+    std::string input;
+    std::string output;
+    uint64_t size;
+};
+
+inline bool isDirectory(const std::string& path) {
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+// Add a file to the batch, or the regular files of a directory in name
+// order, not descending into subdirectories. Returns false if the path
+// cannot be read.
+inline bool addBatchPath(const std::string& path, std::vector<std::string>& paths) {
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        return false;
+    if (!S_ISDIR(status.st_mode)) {
+        paths.push_back(path);
+        return true;
+    }
+    DIR* directory = opendir(path.c_str());
+    if (!directory)
+        return false;
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(directory)) {
+        std::string name = path + "/" + entry->d_name;
+        if (stat(name.c_str(), &status) == 0 && S_ISREG(status.st_mode))
+            names.push_back(name);
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+    paths.insert(paths.end(), names.begin(), names.end());
+    return true;
+}
+
+// Add the paths listed one per line in listFileName; empty lines are
+// skipped
+inline bool addBatchList(const std::string& listFileName, std::vector<std::string>& paths) {
+    std::ifstream list(listFileName);
+    if (!list)
+        return false;
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty() && !addBatchPath(line, paths))
+            return false;
+    }
+    return true;
+}
+
+// Name of the file an input becomes in outputDirectory
+inline std::string batchOutputName(const std::string& input, bool decode, const std::string& outputDirectory) {
+    std::string name = input.substr(input.find_last_of('/') + 1);
+    size_t suffix = sizeof(BATCH_SUFFIX) - 1;
+    if (!decode)
+        name += BATCH_SUFFIX;
+    else if (name.size() > suffix && name.compare(name.size() - suffix, suffix, BATCH_SUFFIX) == 0)
+        name.erase(name.size() - suffix);
+    else
+        name += ".out";
+    return outputDirectory + "/" + name;
+}
+
+// Make the batch of `paths`, largest file first so that the big files do
+// not end up last on a single thread. Returns the first path whose output
+// name another path already has, or an empty string.
+inline std::string makeBatch(const std::vector<std::string>& paths, bool decode, const std::string& outputDirectory,
+                             std::vector<BatchFile>& files) {
+    std::set<std::string> outputs;
+    files.clear();
+    for (const std::string& path : paths) {
+        struct stat status;
+        BatchFile file = {path, batchOutputName(path, decode, outputDirectory), 0};
+        if (stat(path.c_str(), &status) == 0)
+            file.size = static_cast<uint64_t>(status.st_size);
+        if (!outputs.insert(file.output).second)
+            return path;
+        files.push_back(file);
+    }
+    std::stable_sort(files.begin(), files.end(),
+                     [](const BatchFile& a, const BatchFile& b) { return a.size > b.size; });
+    return "";
+}
+
+// Encode or decode one file of the batch with codec and add its size
+// before and after to bytesIn and bytesOut. A file decoded with a codebook
+// must have been coded with it. Returns a description of what went wrong,
+// or nullptr.
+inline const char* processBatchFile(Codec& codec, const Codebook* codebook, const BatchFile& file, bool decode,
+                                    std::vector<unsigned char>& out, uint64_t& bytesIn, uint64_t& bytesOut) {
+    MappedFile input;
+    if (!input.open(file.input))
+        return "Unable to open input file";
+    if (decode) {
+        if (!codec.decompress(input.data(), input.size(), out))
+            return "Invalid encoded file";
+        if (codebook && !codedWith(codec.lastHeader(), *codebook))
+            return "Encoded file was not coded with the codebook";
+    } else {
+        codec.compress(input.data(), input.size(), out);
+    }
+    std::ofstream output(file.output, std::ios::binary);
+    if (!output.write(reinterpret_cast<const char*>(out.data()), out.size()) || !output.flush())
+        return "Unable to write output file";
+    bytesIn += input.size();
+    bytesOut += out.size();
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef HUFFMAN_BIT_IO_H
+#define HUFFMAN_BIT_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Bits are packed most significant bit first, matching the byte layout the
+// encoders have always written.
+
+// Load 8 bytes as a big-endian 64-bit word
+inline uint64_t loadBigEndian64(const unsigned char* p) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return __builtin_bswap64(value);
+#else
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | p[i];
+    return value;
+#endif
+}
+
+// Store a 64-bit word as 8 big-endian bytes
+inline void storeBigEndian64(unsigned char* p, uint64_t value) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap64(value);
+    memcpy(p, &value, sizeof(value));
+#else
+    for (int i = 7; i >= 0; --i) {
+        p[i] = static_cast<unsigned char>(value);
+        value >>= 8;
+    }
+#endif
+}
+
+// Packs codes into a byte buffer through a 64-bit accumulator that is
+// stored a whole word at a time. Only bytes whose bits are all complete are
+// stored; the caller sizes the buffer for the bits it will write.
+class BitWriter {
+public:
+    explicit BitWriter(unsigned char* out) : begin(out), ptr(out), buffer(0), count(0) {}
+
+    // Start writing at bit `bitOffset` of out. The bits before it in the
+    // first byte are stored as zeros.
+    BitWriter(unsigned char* out, uint64_t bitOffset)
+        : begin(out + bitOffset / 8), ptr(begin), buffer(0), count(bitOffset % 8) {}
+
+    // Append the low `length` bits of `bits` (1 <= length <= 64)
+    void put(uint64_t bits, unsigned length) {
+        if (count + length < 64) {
+            buffer = buffer << length | bits;
+            count += length;
+            return;
+        }
+        unsigned room = 64 - count;
+        unsigned rest = length - room;
+        uint64_t word = (room < 64 ? buffer << room : 0) | (rest < 64 ? bits >> rest : 0);
+        storeBigEndian64(ptr, word);
+        ptr += 8;
+        buffer = bits; // bits above `rest` are shifted out before the next store
+        count = rest;
+    }
+
+    // Store every complete byte still buffered and return the last partial
+    // byte, left-aligned and zero padded, without storing it
+    unsigned char finish() {
+        while (count >= 8) {
+            count -= 8;
+            *ptr++ = static_cast<unsigned char>(buffer >> count);
+        }
+        return count ? static_cast<unsigned char>(buffer << (8 - count)) : 0;
+    }
+
+    // Store everything, zero padding the last byte
+    void flush() {
+        unsigned char last = finish();
+        if (count) {
+            *ptr++ = last;
+            count = 0;
+        }
+    }
+
+    // Bytes stored since the last rewind
+    size_t size() const { return ptr - begin; }
+
+    // Restart storing at the beginning of the buffer once its stored bytes
+    // have been consumed; buffered bits carry over
+    void rewind() { ptr = begin; }
+
+    // Bits written since the last rewind, including buffered ones
+    uint64_t position() const { return static_cast<uint64_t>(ptr - begin) * 8 + count; }
+
+private:
+    unsigned char* begin;
+    unsigned char* ptr;
+    uint64_t buffer;
+    unsigned count;
+};
+
+// Reads a packed bit stream through a 64-bit buffer. The buffer holds
+// `count` valid bits left-aligned; refill() tops it up to at least 56 bits
+// while input remains. Reads never go past `end`, so no padding is needed.
+class BitReader {
+public:
+    BitReader() : begin(nullptr), ptr(nullptr), end(nullptr), buffer(0), count(0) {}
+
+    BitReader(const unsigned char* data, size_t size, uint64_t bitOffset = 0)
+        : begin(data), ptr(data + bitOffset / 8), end(data + size), buffer(0), count(0) {
+        refill();
+        consume(bitOffset % 8);
+    }
+
+    void refill() {
+        if (end - ptr >= 8) {
+            buffer |= loadBigEndian64(ptr) >> count;
+            ptr += (63 - count) >> 3;
+            count |= 56;
+        } else {
+            while (count <= 56 && ptr < end) {
+                buffer |= static_cast<uint64_t>(*ptr++) << (56 - count);
+                count += 8;
+            }
+        }
+    }
+
+    // Next n bits (1 <= n <= 56) without consuming them
+    uint64_t peek(unsigned n) const { return buffer >> (64 - n); }
+
+    void consume(unsigned n) {
+        buffer <<= n;
+        count -= n;
+    }
+
+    unsigned available() const { return count; }
+
+    // Bit position of the next unread bit, relative to the start of data
+    uint64_t position() const { return static_cast<uint64_t>(ptr - begin) * 8 - count; }
+
+private:
+    const unsigned char* begin;
+    const unsigned char* ptr;
+    const unsigned char* end;
+    uint64_t buffer;
+    unsigned count;
+};
+
+#endif
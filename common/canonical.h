@@ -0,0 +1,60 @@
+#ifndef HUFFMAN_CANONICAL_H
+#define HUFFMAN_CANONICAL_H
+
+#include <array>
+#include <cstdint>
+
+#include "huffman_code.h"
+
+// Canonical Huffman codes. Only the code length of each byte value is
+// stored; codes are reassigned in order of (length, byte value), so encoder
+// and decoder derive identical codes from the 256 lengths alone.
+
+// Code lengths indexed by byte value; 0 = symbol absent
+typedef std::array<uint8_t, 256> CodeLengths;
+
+const unsigned MAX_CODE_LENGTH = 64;
+
+// Code lengths of the symbols that have a code. A lone symbol, whose code
+// is empty, gets a 1-bit code.
+inline CodeLengths codeLengths(const CodeTable& codes, const uint64_t* frequencies) {
+    CodeLengths lengths = {};
+    for (unsigned symbol = 0; symbol < 256; ++symbol) {
+        if (frequencies[symbol] != 0)
+            lengths[symbol] = codes[symbol].length ? codes[symbol].length : 1;
+    }
+    return lengths;
+}
+
+// Assign canonical codes from code lengths. Returns false if the lengths
+// are too long or oversubscribe the code space.
+inline bool canonicalCodes(const CodeLengths& lengths, CodeTable& codes) {
+    unsigned count[MAX_CODE_LENGTH + 1] = {};
+    for (unsigned symbol = 0; symbol < 256; ++symbol) {
+        if (lengths[symbol] > MAX_CODE_LENGTH)
+            return false;
+        count[lengths[symbol]]++;
+    }
+    count[0] = 0;
+
+    // First code of each length
+    uint64_t next[MAX_CODE_LENGTH + 1] = {};
+    uint64_t code = 0;
+    for (unsigned length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code = (code + count[length - 1]) << 1;
+        next[length] = code;
+        // Codes of this length must fit in `length` bits
+        if (length < 64 && (code > (uint64_t(1) << length) ||
+                            count[length] > (uint64_t(1) << length) - code))
+            return false;
+    }
+
+    for (unsigned symbol = 0; symbol < 256; ++symbol) {
+        unsigned length = lengths[symbol];
+        codes[symbol].length = static_cast<uint8_t>(length);
+        codes[symbol].bits = length ? next[length]++ : 0;
+    }
+    return true;
+}
+
+#endif
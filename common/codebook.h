@@ -0,0 +1,105 @@
+#ifndef HUFFMAN_CODEBOOK_H
+#define HUFFMAN_CODEBOOK_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "container.h"
+#include "encode.h"
+#include "histogram.h"
+
+// Shared codebook for coding many small, similar inputs without counting
+// each of them first. A codebook holds code lengths trained on a sample
+// corpus, with every byte value counted at least once, so bytes the sample
+// never held still have a (long) code and no escape is needed. Containers
+// coded with a codebook carry FLAG_CODEBOOK and its id as well as the code
+// lengths themselves: they decode without the codebook, and a decoder that
+// holds it checks the id and reuses the codebook's decode table.
+//
+// File layout, integers little-endian:
+//   magic        4 bytes  "HUFB"
+//   version      u16
+//   code lengths 256 bytes, one per byte value, none of them 0
+
+const char CODEBOOK_MAGIC[4] = {'H', 'U', 'F', 'B'};
+const uint16_t CODEBOOK_VERSION = 1;
+const size_t CODEBOOK_SIZE = 4 + 2 + 256;
+
+struct Codebook {
+    CodeLengths lengths;
+    uint64_t id;
+    CodeTable codes;     // encoder codes
+    DecodeTables tables; // the one decode table
+};
+
+// Id of a set of code lengths, their 64-bit FNV-1a hash
+inline uint64_t codebookId(const CodeLengths& lengths) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint8_t length : lengths) {
+        hash ^= length;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Code lengths of at most maxLength bits for the byte histogram of a
+// sample, every byte value counted once more so that it has a code
+inline CodeLengths trainCodebook(Histogram histogram, unsigned maxLength) {
+    for (int symbol = 0; symbol < 256; ++symbol)
+        histogram[symbol]++;
+    return huffmanCodeLengths(histogram, maxLength);
+}
+
+// Fill in the codebook of a set of code lengths. Returns false unless
+// every byte value has a code.
+inline bool setCodebookLengths(const CodeLengths& lengths, Codebook& codebook) {
+    for (uint8_t length : lengths) {
+        if (length == 0)
+            return false;
+    }
+    ContainerHeader header;
+    header.lengths = lengths;
+    if (!canonicalCodes(lengths, codebook.codes) || !buildDecodeTables(header, codebook.tables))
+        return false;
+    codebook.lengths = lengths;
+    codebook.id = codebookId(lengths);
+    return true;
+}
+
+inline bool writeCodebook(const std::string& fileName, const CodeLengths& lengths) {
+    unsigned char bytes[CODEBOOK_SIZE];
+    memcpy(bytes, CODEBOOK_MAGIC, 4);
+    putLittleEndian(bytes + 4, CODEBOOK_VERSION, 2);
+    memcpy(bytes + 6, lengths.data(), 256);
+    std::ofstream out(fileName, std::ios::binary);
+    return out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes)) && out.flush();
+}
+
+inline bool readCodebook(const std::string& fileName, Codebook& codebook) {
+    std::ifstream in(fileName, std::ios::binary);
+    unsigned char bytes[CODEBOOK_SIZE];
+    if (!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)) || memcmp(bytes, CODEBOOK_MAGIC, 4) != 0 ||
+        getLittleEndian(bytes + 4, 2) != CODEBOOK_VERSION)
+        return false;
+    CodeLengths lengths;
+    memcpy(lengths.data(), bytes + 6, 256);
+    return setCodebookLengths(lengths, codebook);
+}
+
+// Code a container with the codebook
+inline void useCodebook(const Codebook& codebook, ContainerHeader& header) {
+    header.flags |= FLAG_CODEBOOK;
+    header.codebookId = codebook.id;
+    header.lengths = codebook.lengths;
+}
+
+// Whether a container was coded with the codebook, so that its decode
+// table serves for the container
+inline bool codedWith(const ContainerHeader& header, const Codebook& codebook) {
+    return (header.flags & FLAG_CODEBOOK) && !(header.flags & FLAG_MULTI_TABLE) &&
+           header.codebookId == codebook.id && header.lengths == codebook.lengths;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef HUFFMAN_CODEC_H
+#define HUFFMAN_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "codebook.h"
+#include "container.h"
+#include "encode.h"
+#include "histogram.h"
+#include "multi_table.h"
+
+// In-memory compression of whole buffers into the same container the
+// programs write, for callers that hold their data in memory rather than
+// in files. A Codec keeps its code tables, decode tables and scratch
+// buffers from one call to the next, so compressing many small buffers
+// allocates little once the buffers have grown, and decoding a run of
+// containers with the same code lengths builds the decode tables once.
+//
+// A Codec is not safe to share between threads; give each thread its own.
+// Blocks are encoded and decoded in parallel when built with OpenMP.
+
+// Input bytes per code table from which decoding repays the cost of
+// building the widest decode tables
+const uint64_t WIDE_TABLE_BYTES = 32768;
+
+// Settings of the containers a Codec writes, as the encoders' options
+struct CodecOptions {
+    unsigned tables;        // code tables, 1 to MAX_CODE_TABLES (--tables)
+    unsigned maxCodeLength; // MIN_CODE_LENGTH_LIMIT to MAX_CODE_LENGTH_LIMIT (--max-code-length)
+    unsigned streams;       // streams per block, 1 to MAX_STREAMS (--interleave)
+    uint32_t blockSize;     // input bytes per block
+
+    CodecOptions()
+        : tables(1), maxCodeLength(MAX_CODE_LENGTH_LIMIT), streams(1), blockSize(DEFAULT_BLOCK_SIZE) {}
+};
+
+class Codec {
+public:
+    explicit Codec(const CodecOptions& options = CodecOptions())
+        : options(options), hasCodebook(false), builtBits(0) {}
+
+    // Code with a shared codebook instead of the code of each input, and
+    // decode containers coded with it with its decode table. options.tables
+    // no longer applies.
+    void setCodebook(const Codebook& shared) {
+        codebook = shared;
+        hasCodebook = true;
+        builtLengths.assign(1, shared.lengths);
+        decodeTables = shared.tables;
+        builtBits = DecodeTable::BITS;
+    }
+
+    // Compress n bytes of input into a container, replacing the contents of
+    // out. The container is byte for byte what the encoders write for the
+    // same input and options without --stream.
+    void compress(const unsigned char* input, size_t n, std::vector<unsigned char>& out) {
+        header.flags = 0;
+        header.inputSize = n;
+        header.bitCount = 0;
+        header.blockSize = options.blockSize;
+        header.extraLengths.clear();
+        header.selectors.clear();
+        header.setStreams(options.streams);
+
+        // The block histograms also give the blocks their offsets
+        histograms = countBlockHistograms(input, n, header.blockSize);
+        if (hasCodebook) {
+            useCodebook(codebook, header);
+            codes.assign(1, codebook.codes);
+        } else {
+            Histogram total = totalHistogram(histograms);
+            header.lengths = huffmanCodeLengths(total, options.maxCodeLength);
+            codes.resize(1);
+            canonicalCodes(header.lengths, codes[0]);
+            if (options.tables > 1)
+                chooseCodeTables(histograms, 0, total, options.tables, options.maxCodeLength,
+                                 [](Histogram*, unsigned) {}, header, codes);
+        }
+
+        header.blockOffsets.assign(header.indexSize(), 0);
+        unsigned char carry = 0;
+        encodeBlockRange(input, codes, histograms, header, 0, carry, data);
+
+        out.resize(header.dataOffset() + header.dataSize());
+        serializeHeader(header, out.data());
+        if (!data.empty())
+            memcpy(out.data() + header.dataOffset(), data.data(), data.size());
+        if (header.bitCount % 8 != 0)
+            out.back() = carry;
+    }
+
+    std::vector<unsigned char> compress(const unsigned char* input, size_t n) {
+        std::vector<unsigned char> out;
+        compress(input, n, out);
+        return out;
+    }
+
+    // Decompress a container of `size` bytes, replacing the contents of
+    // out. Returns false if it is not a valid container; out is then
+    // unspecified.
+    bool decompress(const unsigned char* container, size_t size, std::vector<unsigned char>& out) {
+        if (!parseHeader(container, size, header) || !buildTables())
+            return false;
+
+        out.resize(header.inputSize);
+        const unsigned char* encoded = container + header.dataOffset();
+        int64_t blockCount = header.blockCount();
+        bool valid = true;
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic) reduction(&& : valid) if (blockCount > 1)
+#endif
+        for (int64_t b = 0; b < blockCount; ++b)
+            valid = decodeBlocks(header, decodeTables, encoded, header.dataSize(), 0, b, b + 1,
+                                 out.data() + header.blockBegin(b)) && valid;
+        return valid;
+    }
+
+    // Header of the container last compressed or decompressed
+    const ContainerHeader& lastHeader() const { return header; }
+
+private:
+    // Build the decode tables of the header, unless those of the previous
+    // container had the same code lengths. Small containers get narrower
+    // tables, as building the widest would take longer than decoding them.
+    bool buildTables() {
+        unsigned bits =
+            header.inputSize >= WIDE_TABLE_BYTES * header.tableCount() ? DecodeTable::BITS : DecodeTable::SMALL_BITS;
+        bool same = !builtLengths.empty() && builtLengths.size() == header.tableCount() && builtBits >= bits;
+        for (unsigned t = 0; same && t < header.tableCount(); ++t)
+            same = builtLengths[t] == header.tableLengths(t);
+        if (same)
+            return true;
+
+        builtLengths.clear();
+        if (!buildDecodeTables(header, decodeTables, bits))
+            return false;
+        for (unsigned t = 0; t < header.tableCount(); ++t)
+            builtLengths.push_back(header.tableLengths(t));
+        builtBits = bits;
+        return true;
+    }
+
+    CodecOptions options;
+    Codebook codebook;
+    bool hasCodebook;
+    ContainerHeader header;
+    std::vector<Histogram> histograms;
+    std::vector<CodeTable> codes;
+    std::vector<unsigned char> data;
+    DecodeTables decodeTables;
+    std::vector<CodeLengths> builtLengths; // code lengths decodeTables were built from
+    unsigned builtBits; // bits of input indexing decodeTables
+};
+
+// Compress a buffer with a Codec of its own
+inline std::vector<unsigned char> compress(const unsigned char* input, size_t n,
+                                           const CodecOptions& options = CodecOptions()) {
+    return Codec(options).compress(input, n);
+}
+
+// Decompress a container with a Codec of its own
+inline bool decompress(const unsigned char* container, size_t size, std::vector<unsigned char>& out) {
+    return Codec().decompress(container, size, out);
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef HUFFMAN_CONTAINER_H
+#define HUFFMAN_CONTAINER_H
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "canonical.h"
+#include "decode_table.h"
+
+// Single-file compressed container written and read by every variant.
+//
+// Layout, integers little-endian:
+//   magic        4 bytes  "HUFZ"
+//   version      u16
+//   flags        u16
+//   input size   u64      original length in bytes
+//   bit count    u64      exact number of encoded bits
+//   block size   u32      input bytes per block; the last block may be shorter
+//   code lengths 256 bytes, one per byte value (see canonical.h)
+//   with FLAG_INTERLEAVED only:
+//     stream count u8     streams each block is split into
+//   with FLAG_CODEBOOK only:
+//     codebook id  u64    id of the shared codebook the code lengths above
+//                         were taken from (see codebook.h)
+//   with FLAG_MULTI_TABLE only:
+//     table count  u8     number of code tables, the first being the code
+//                         lengths above
+//     code lengths 256 bytes for each further table
+//     selectors    u8 per block: the table the block is coded with
+//   block index  u64 per stream of each block: bit offset of the stream
+//                within the data; one stream per block unless interleaved
+//   data         (bit count + 7) / 8 bytes of packed codes
+//
+// Every block starts on a known bit offset and decodes to a known number
+// of bytes, so decoders can size their output and split blocks across
+// threads or ranks without scanning the data first.
+//
+// An interleaved block is cut into `streams` runs of input bytes of nearly
+// equal length, coded one after the other. Their codes are the same bits
+// a single stream would hold; knowing where each run starts lets a decoder
+// work through all of them at once.
+
+const char CONTAINER_MAGIC[4] = {'H', 'U', 'F', 'Z'};
+const uint16_t CONTAINER_VERSION = 1;
+const size_t CONTAINER_FIXED_SIZE = 4 + 2 + 2 + 8 + 8 + 4 + 256;
+
+// Blocks are coded with one of several code tables
+const uint16_t FLAG_MULTI_TABLE = 2;
+// Blocks are split into several streams
+const uint16_t FLAG_INTERLEAVED = 4;
+// The code lengths come from a shared codebook. They are still stored, so
+// the file decodes without the codebook.
+const uint16_t FLAG_CODEBOOK = 8;
+const uint16_t CONTAINER_FLAGS = FLAG_MULTI_TABLE | FLAG_INTERLEAVED | FLAG_CODEBOOK;
+
+const unsigned MAX_CODE_TABLES = 8;
+const unsigned MAX_STREAMS = 8;
+
+const uint32_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+// Input bytes the streaming encoders and decoders hold at a time
+const size_t STREAM_BUFFER_SIZE = 16 << 20;
+
+struct ContainerHeader {
+    uint16_t version;
+    uint16_t flags;
+    uint64_t inputSize;
+    uint64_t bitCount;
+    uint32_t blockSize;
+    CodeLengths lengths;
+    unsigned streams;                      // streams per block, more than one with FLAG_INTERLEAVED
+    uint64_t codebookId;                   // with FLAG_CODEBOOK
+    std::vector<CodeLengths> extraLengths; // tables after the first, with FLAG_MULTI_TABLE
+    std::vector<uint8_t> selectors;        // table of each block, with FLAG_MULTI_TABLE
+    std::vector<uint64_t> blockOffsets;    // offset of stream s of block b at streamIndex(b, s)
+
+    ContainerHeader()
+        : version(CONTAINER_VERSION), flags(0), inputSize(0), bitCount(0),
+          blockSize(DEFAULT_BLOCK_SIZE), lengths(), streams(1), codebookId(0) {}
+
+    uint64_t blockCount() const { return inputSize / blockSize + (inputSize % blockSize != 0); }
+
+    // Split every block into `count` streams
+    void setStreams(unsigned count) {
+        streams = count;
+        if (count > 1)
+            flags |= FLAG_INTERLEAVED;
+        else
+            flags &= ~FLAG_INTERLEAVED;
+    }
+
+    unsigned tableCount() const { return 1 + static_cast<unsigned>(extraLengths.size()); }
+    const CodeLengths& tableLengths(unsigned t) const { return t == 0 ? lengths : extraLengths[t - 1]; }
+    unsigned blockTable(uint64_t b) const { return flags & FLAG_MULTI_TABLE ? selectors[b] : 0; }
+
+    // Byte offsets of the codebook id, the code tables, the selectors, the
+    // block index and the data within the file
+    uint64_t codebookOffset() const { return CONTAINER_FIXED_SIZE + (flags & FLAG_INTERLEAVED ? 1 : 0); }
+    uint64_t tablesOffset() const { return codebookOffset() + (flags & FLAG_CODEBOOK ? 8 : 0); }
+    uint64_t selectorOffset() const {
+        return flags & FLAG_MULTI_TABLE ? tablesOffset() + 1 + 256 * extraLengths.size() : tablesOffset();
+    }
+    uint64_t indexOffset() const { return selectorOffset() + (flags & FLAG_MULTI_TABLE ? blockCount() : 0); }
+    uint64_t dataOffset() const { return indexOffset() + 8 * indexSize(); }
+    uint64_t dataSize() const { return bitCount / 8 + (bitCount % 8 != 0); }
+
+    // Number of block index entries
+    uint64_t indexSize() const { return blockCount() * streams; }
+    uint64_t streamIndex(uint64_t b, unsigned s) const { return b * streams + s; }
+
+    // Block b covers input bytes [blockBegin(b), blockEnd(b)) and data bits
+    // [blockBitBegin(b), blockBitEnd(b))
+    uint64_t blockBegin(uint64_t b) const { return b * blockSize; }
+    uint64_t blockEnd(uint64_t b) const {
+        return b + 1 < blockCount() ? (b + 1) * blockSize : inputSize;
+    }
+    uint64_t blockBitBegin(uint64_t b) const { return blockOffsets[streamIndex(b, 0)]; }
+    uint64_t blockBitEnd(uint64_t b) const {
+        return b + 1 < blockCount() ? blockOffsets[streamIndex(b + 1, 0)] : bitCount;
+    }
+
+    // Stream s of block b covers input bytes [streamBegin(b, s),
+    // streamBegin(b, s + 1)) and data bits [streamBitBegin(b, s),
+    // streamBitBegin(b, s + 1)); stream `streams` stands for the block end
+    uint64_t streamBegin(uint64_t b, unsigned s) const {
+        return blockBegin(b) + (blockEnd(b) - blockBegin(b)) * s / streams;
+    }
+    uint64_t streamBitBegin(uint64_t b, unsigned s) const {
+        return s < streams ? blockOffsets[streamIndex(b, s)] : blockBitEnd(b);
+    }
+};
+
+// Blocks held at a time when streaming: at least one, and as many as fit
+// in STREAM_BUFFER_SIZE
+inline uint64_t streamBlockCount(const ContainerHeader& header) {
+    uint64_t blocks = STREAM_BUFFER_SIZE / header.blockSize;
+    return blocks ? blocks : 1;
+}
+
+inline void putLittleEndian(unsigned char* p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i)
+        p[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline uint64_t getLittleEndian(const unsigned char* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+// Fixed part of the header, CONTAINER_FIXED_SIZE bytes
+inline void serializeFixedHeader(const ContainerHeader& header, unsigned char* p) {
+    memcpy(p, CONTAINER_MAGIC, 4);
+    putLittleEndian(p + 4, header.version, 2);
+    putLittleEndian(p + 6, header.flags, 2);
+    putLittleEndian(p + 8, header.inputSize, 8);
+    putLittleEndian(p + 16, header.bitCount, 8);
+    putLittleEndian(p + 24, header.blockSize, 4);
+    memcpy(p + 28, header.lengths.data(), 256);
+}
+
+// Table count and the code lengths of the further tables, the
+// selectorOffset() - tablesOffset() bytes from tablesOffset() on with
+// FLAG_MULTI_TABLE
+inline void serializeTables(const ContainerHeader& header, unsigned char* p) {
+    p[0] = static_cast<unsigned char>(header.tableCount());
+    for (size_t t = 0; t < header.extraLengths.size(); ++t)
+        memcpy(p + 1 + 256 * t, header.extraLengths[t].data(), 256);
+}
+
+// Everything before the selectors, selectorOffset() bytes: the fixed part
+// of the header, the stream count, the codebook id and the code tables
+inline void serializeHeaderStart(const ContainerHeader& header, unsigned char* p) {
+    serializeFixedHeader(header, p);
+    if (header.flags & FLAG_INTERLEAVED)
+        p[CONTAINER_FIXED_SIZE] = static_cast<unsigned char>(header.streams);
+    if (header.flags & FLAG_CODEBOOK)
+        putLittleEndian(p + header.codebookOffset(), header.codebookId, 8);
+    if (header.flags & FLAG_MULTI_TABLE)
+        serializeTables(header, p + header.tablesOffset());
+}
+
+// Selectors of blocks [first, last); the selector of block b sits at byte
+// selectorOffset() + b of the file
+inline void serializeSelectors(const ContainerHeader& header, uint64_t first, uint64_t last,
+                               unsigned char* p) {
+    if (last > first)
+        memcpy(p, header.selectors.data() + first, last - first);
+}
+
+// Block index entries of blocks [first, last); entry i sits at byte
+// indexOffset() + 8 * i of the file
+inline void serializeBlockIndex(const ContainerHeader& header, uint64_t first, uint64_t last,
+                                unsigned char* p) {
+    for (uint64_t i = header.streamIndex(first, 0); i < header.streamIndex(last, 0); ++i)
+        putLittleEndian(p + 8 * (i - header.streamIndex(first, 0)), header.blockOffsets[i], 8);
+}
+
+// Header and block index as they appear at the start of the file, the
+// first dataOffset() bytes of p
+inline void serializeHeader(const ContainerHeader& header, unsigned char* p) {
+    serializeHeaderStart(header, p);
+    if (header.flags & FLAG_MULTI_TABLE)
+        serializeSelectors(header, 0, header.blockCount(), p + header.selectorOffset());
+    serializeBlockIndex(header, 0, header.blockCount(), p + header.indexOffset());
+}
+
+inline std::vector<unsigned char> serializeHeader(const ContainerHeader& header) {
+    std::vector<unsigned char> bytes(header.dataOffset());
+    serializeHeader(header, bytes.data());
+    return bytes;
+}
+
+// Parse the fixed part of the header; the block index follows it
+inline bool parseFixedHeader(const unsigned char* p, ContainerHeader& header) {
+    if (memcmp(p, CONTAINER_MAGIC, 4) != 0)
+        return false;
+    header.version = static_cast<uint16_t>(getLittleEndian(p + 4, 2));
+    header.flags = static_cast<uint16_t>(getLittleEndian(p + 6, 2));
+    header.inputSize = getLittleEndian(p + 8, 8);
+    header.bitCount = getLittleEndian(p + 16, 8);
+    header.blockSize = static_cast<uint32_t>(getLittleEndian(p + 24, 4));
+    memcpy(header.lengths.data(), p + 28, 256);
+    header.streams = 1;
+    header.codebookId = 0;
+    header.extraLengths.clear();
+    header.selectors.clear();
+    return header.version == CONTAINER_VERSION && header.blockSize != 0 &&
+           (header.flags & ~CONTAINER_FLAGS) == 0;
+}
+
+// Parse the stream count following the fixed part of the header
+inline bool parseStreams(const unsigned char* p, ContainerHeader& header) {
+    header.streams = p[0];
+    return header.streams > 1 && header.streams <= MAX_STREAMS;
+}
+
+// Size of the table count and further code lengths with tableCount tables
+inline size_t tablesSize(unsigned tableCount) { return 1 + 256 * (tableCount - 1); }
+
+// Parse the table count and further code lengths following the fixed part
+// of the header. p holds tablesSize(p[0]) bytes.
+inline bool parseTables(const unsigned char* p, ContainerHeader& header) {
+    if (p[0] == 0 || p[0] > MAX_CODE_TABLES)
+        return false;
+    header.extraLengths.resize(p[0] - 1);
+    for (size_t t = 0; t < header.extraLengths.size(); ++t)
+        memcpy(header.extraLengths[t].data(), p + 1 + 256 * t, 256);
+    return true;
+}
+
+// Parse the selector of every block
+inline bool parseSelectors(const unsigned char* p, ContainerHeader& header) {
+    header.selectors.assign(p, p + header.blockCount());
+    for (uint8_t selector : header.selectors) {
+        if (selector >= header.tableCount())
+            return false;
+    }
+    return true;
+}
+
+inline bool parseBlockIndex(const unsigned char* p, ContainerHeader& header) {
+    header.blockOffsets.resize(header.indexSize());
+    for (uint64_t i = 0; i < header.indexSize(); ++i) {
+        header.blockOffsets[i] = getLittleEndian(p + 8 * i, 8);
+        if (header.blockOffsets[i] > header.bitCount ||
+            (i > 0 && header.blockOffsets[i] < header.blockOffsets[i - 1]))
+            return false;
+    }
+    return true;
+}
+
+// Whether the selectors, block index and data the header describes fit in
+// the `available` bytes from selectorOffset() on. Checked before anything
+// is sized from the header, whose sizes may be corrupt, and without
+// overflowing. Every code is at least one bit long, which bounds the input
+// size, and so the decoded output, by the data actually present.
+inline bool bodyFits(const ContainerHeader& header, uint64_t available) {
+    if (header.inputSize > header.bitCount)
+        return false;
+    uint64_t blocks = header.blockCount();
+    if (header.flags & FLAG_MULTI_TABLE) {
+        if (blocks > available)
+            return false;
+        available -= blocks;
+    }
+    if (blocks > available / 8 / header.streams)
+        return false;
+    available -= 8 * blocks * header.streams;
+    return header.dataSize() <= available;
+}
+
+inline void writeHeader(std::ostream& out, const ContainerHeader& header) {
+    std::vector<unsigned char> bytes = serializeHeader(header);
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+// Read the header and block index, leaving the stream at the data.
+// Like parseHeader, checks that the file holds all of the data.
+inline bool readHeader(std::istream& in, ContainerHeader& header) {
+    unsigned char fixed[CONTAINER_FIXED_SIZE];
+    if (!in.read(reinterpret_cast<char*>(fixed), sizeof(fixed)) || !parseFixedHeader(fixed, header))
+        return false;
+    // The length of the rest of the stream bounds everything sized from
+    // the header
+    std::streampos start = in.tellg();
+    if (start < 0 || !in.seekg(0, std::ios::end))
+        return false;
+    std::streampos end = in.tellg();
+    if (end < start || !in.seekg(start))
+        return false;
+    if (header.flags & FLAG_INTERLEAVED) {
+        unsigned char streams;
+        if (!in.read(reinterpret_cast<char*>(&streams), 1) || !parseStreams(&streams, header))
+            return false;
+    }
+    if (header.flags & FLAG_CODEBOOK) {
+        unsigned char id[8];
+        if (!in.read(reinterpret_cast<char*>(id), 8))
+            return false;
+        header.codebookId = getLittleEndian(id, 8);
+    }
+    if (header.flags & FLAG_MULTI_TABLE) {
+        std::vector<unsigned char> tables(1);
+        if (!in.read(reinterpret_cast<char*>(tables.data()), 1) || tables[0] == 0)
+            return false;
+        tables.resize(tablesSize(tables[0]));
+        if (!in.read(reinterpret_cast<char*>(tables.data() + 1), tables.size() - 1) ||
+            !parseTables(tables.data(), header))
+            return false;
+    }
+    std::streampos body = in.tellg();
+    if (body < 0 || body > end || !bodyFits(header, static_cast<uint64_t>(end - body)))
+        return false;
+    if (header.flags & FLAG_MULTI_TABLE) {
+        std::vector<unsigned char> selectors(header.blockCount());
+        if (!in.read(reinterpret_cast<char*>(selectors.data()), selectors.size()) ||
+            !parseSelectors(selectors.data(), header))
+            return false;
+    }
+    std::vector<unsigned char> index(8 * header.indexSize());
+    return in.read(reinterpret_cast<char*>(index.data()), index.size()) && parseBlockIndex(index.data(), header);
+}
+
+// Parse the header and block index from the start of a file held in
+// memory, checking that the file holds all of the data
+inline bool parseHeader(const unsigned char* p, size_t size, ContainerHeader& header) {
+    if (size < CONTAINER_FIXED_SIZE || !parseFixedHeader(p, header))
+        return false;
+    if (header.flags & FLAG_INTERLEAVED) {
+        if (size == CONTAINER_FIXED_SIZE || !parseStreams(p + CONTAINER_FIXED_SIZE, header))
+            return false;
+    }
+    if (header.flags & FLAG_CODEBOOK) {
+        if (size < header.tablesOffset())
+            return false;
+        header.codebookId = getLittleEndian(p + header.codebookOffset(), 8);
+    }
+    if (header.flags & FLAG_MULTI_TABLE) {
+        uint64_t tables = header.tablesOffset();
+        if (size == tables || p[tables] == 0 || size - tables < tablesSize(p[tables]) ||
+            !parseTables(p + tables, header))
+            return false;
+    }
+    uint64_t body = header.selectorOffset();
+    if (size < body || !bodyFits(header, size - body))
+        return false;
+    if ((header.flags & FLAG_MULTI_TABLE) && !parseSelectors(p + body, header))
+        return false;
+    return parseBlockIndex(p + header.indexOffset(), header);
+}
+
+// Decode tables indexed by table number
+typedef std::vector<DecodeTable> DecodeTables;
+
+// Rebuild the canonical codes and decode table of every code table
+// described by the header, each indexed by tableBits bits of input
+inline bool buildDecodeTables(const ContainerHeader& header, DecodeTables& tables,
+                              unsigned tableBits = DecodeTable::BITS) {
+    tables.resize(header.tableCount());
+    for (unsigned t = 0; t < header.tableCount(); ++t) {
+        CodeTable codes;
+        if (!canonicalCodes(header.tableLengths(t), codes))
+            return false;
+        if (!tables[t].build(codes, tableBits))
+            return false;
+    }
+    return true;
+}
+
+// Decode the streams of interleaved block b into out, side by side for
+// the common stream counts
+inline bool decodeInterleavedBlock(const ContainerHeader& header, const DecodeTable& table,
+                                   const unsigned char* data, size_t size, uint64_t dataBegin, uint64_t b,
+                                   unsigned char* out) {
+    uint64_t bitBounds[MAX_STREAMS + 1];
+    uint64_t outBounds[MAX_STREAMS + 1];
+    for (unsigned s = 0; s <= header.streams; ++s) {
+        bitBounds[s] = header.streamBitBegin(b, s) - 8 * dataBegin;
+        outBounds[s] = header.streamBegin(b, s) - header.blockBegin(b);
+    }
+    switch (header.streams) {
+    case 2:
+        return table.decodeStreams<2>(data, size, bitBounds, out, outBounds);
+    case 4:
+        return table.decodeStreams<4>(data, size, bitBounds, out, outBounds);
+    case 8:
+        return table.decodeStreams<8>(data, size, bitBounds, out, outBounds);
+    }
+    for (unsigned s = 0; s < header.streams; ++s) {
+        if (!table.decodeSymbols(data, size, bitBounds[s], bitBounds[s + 1], out + outBounds[s],
+                                 outBounds[s + 1] - outBounds[s]))
+            return false;
+    }
+    return true;
+}
+
+// Decode blocks [first, last) into out, which receives input bytes from
+// blockBegin(first) on. `data` holds the encoded bytes starting at data
+// byte `dataBegin`.
+inline bool decodeBlocks(const ContainerHeader& header, const DecodeTables& tables,
+                         const unsigned char* data, size_t size, uint64_t dataBegin,
+                         uint64_t first, uint64_t last, unsigned char* out) {
+    for (uint64_t b = first; b < last; ++b) {
+        const DecodeTable& table = tables[header.blockTable(b)];
+        unsigned char* blockOut = out + (header.blockBegin(b) - header.blockBegin(first));
+        bool valid = header.streams > 1
+                         ? decodeInterleavedBlock(header, table, data, size, dataBegin, b, blockOut)
+                         : table.decodeSymbols(data, size, header.blockBitBegin(b) - 8 * dataBegin,
+                                               header.blockBitEnd(b) - 8 * dataBegin, blockOut,
+                                               header.blockEnd(b) - header.blockBegin(b));
+        if (!valid)
+            return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef HUFFMAN_DECODE_TABLE_H
+#define HUFFMAN_DECODE_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bit_io.h"
+#include "huffman_code.h"
+
+// Table-driven Huffman decoder shared by every variant.
+//
+// The next DecodeTable::BITS bits of input, or fewer for a table built
+// narrower, index a table whose entry holds as many whole codes as fit in
+// those bits, up to three, with their symbols and total length, so each
+// load yields one to three symbols instead of one pointer chase per bit.
+// Each load depends on the length taken from the one before, so that
+// length sits in the low bits of the entry where it is used without
+// shifting. Codes longer than the table width continue bit by bit through
+// a small flat trie.
+class DecodeTable {
+public:
+    static const unsigned BITS = 13;
+    // Width of a table that builds quickly for short inputs
+    static const unsigned SMALL_BITS = 10;
+
+    // Build the table from a prefix code, indexed by tableBits bits of input
+    // (at most BITS). Returns false if the codes do not form a valid prefix
+    // code.
+    bool build(const CodeTable& codes, unsigned tableBits = BITS) {
+        bits = tableBits;
+        size_t size = size_t(1) << bits;
+        for (size_t i = 0; i < size; ++i) {
+            entries[i] = 0;
+            firstLengths[i] = 0;
+        }
+        trie.assign(2, 0); // node 0 marks an invalid code
+
+        for (unsigned symbol = 0; symbol < 256; ++symbol) {
+            unsigned length = codes[symbol].length;
+            uint64_t code = codes[symbol].bits;
+            if (length == 0)
+                continue;
+
+            if (length <= bits) {
+                // Every index starting with this code decodes to the symbol
+                size_t first = static_cast<size_t>(code) << (bits - length);
+                size_t last = first + (size_t(1) << (bits - length));
+                for (size_t i = first; i < last; ++i) {
+                    if (entries[i] != 0)
+                        return false;
+                    entries[i] = makeEntry(symbol, length, 1);
+                    firstLengths[i] = static_cast<uint8_t>(length);
+                }
+                continue;
+            }
+
+            // Long code: the table entry points at a trie node that consumes
+            // the remaining bits
+            size_t prefix = static_cast<size_t>(code >> (length - bits));
+            if (entryCount(entries[prefix]) != 0)
+                return false;
+            int node = entryNode(entries[prefix]);
+            if (node == 0) {
+                node = newNode();
+                if (node > 0xffff)
+                    return false;
+                entries[prefix] = static_cast<uint32_t>(node) << 8;
+            }
+            for (unsigned i = length - bits; i-- > 0;) {
+                size_t slot = 2 * node + ((code >> i) & 1);
+                if (i == 0) {
+                    if (trie[slot] != 0)
+                        return false;
+                    trie[slot] = -static_cast<int>(symbol) - 1;
+                } else {
+                    if (trie[slot] < 0)
+                        return false;
+                    if (trie[slot] == 0) {
+                        int child = newNode();
+                        trie[slot] = child;
+                    }
+                    node = trie[slot];
+                }
+            }
+        }
+
+        // Follow each short code with up to two more while they fit. The
+        // bits past a code index the entry of the next one, whose first
+        // symbol and length stay put as entries gain further symbols.
+        for (size_t i = 0; i < size; ++i) {
+            unsigned length = firstLengths[i];
+            if (length == 0)
+                continue;
+            uint32_t entry = entries[i] & 0xff00;
+            unsigned count = 1;
+            for (; count < 3; ++count) {
+                size_t next = (i << length) & (size - 1);
+                unsigned nextLength = firstLengths[next];
+                if (nextLength == 0 || length + nextLength > bits)
+                    break;
+                length += nextLength;
+                entry |= (entries[next] & 0xff00) << (8 * count);
+            }
+            entries[i] = entry | makeEntry(0, length, count);
+        }
+        return true;
+    }
+
+    // Decode exactly `count` symbols starting at bit `bitBegin` of data into
+    // out. Returns false on an invalid code or if the symbols would run past
+    // bitEnd.
+    bool decodeSymbols(const unsigned char* data, size_t size, uint64_t bitBegin,
+                       uint64_t bitEnd, unsigned char* out, size_t count) const {
+        BitReader reader(data, size, bitBegin);
+        unsigned char* end = out + count;
+
+        // HITS table hits write at most 3 * HITS bytes
+        while (end - out >= 3 * HITS) {
+            reader.refill();
+            if (reader.position() + 64 > bitEnd)
+                break;
+            unsigned k = 0;
+            for (; k < HITS; ++k) {
+                uint32_t entry = entries[reader.peek(bits)];
+                if (entryCount(entry) == 0)
+                    break;
+                writeSymbols(entry, out);
+                reader.consume(entryLength(entry));
+            }
+            if (k < HITS && decodeOne(reader, bitEnd, *out++) != DECODED)
+                return false;
+        }
+        while (out < end) {
+            if (decodeOne(reader, bitEnd, *out++) != DECODED)
+                return false;
+        }
+        return true;
+    }
+
+    // Decode N streams side by side, taking turns between them so that the
+    // table lookups of one stream overlap those of the others instead of
+    // each waiting on the one before. Stream s holds the codes in bits
+    // [bitBounds[s], bitBounds[s + 1]) of data and decodes to out
+    // [outBounds[s], outBounds[s + 1]). Returns false on an invalid code or
+    // if a stream's symbols would run past its end.
+    template <unsigned N>
+    bool decodeStreams(const unsigned char* data, size_t size, const uint64_t* bitBounds,
+                       unsigned char* out, const uint64_t* outBounds) const {
+        BitReader readers[N];
+        unsigned char* outs[N];
+        unsigned char* ends[N];
+        for (unsigned s = 0; s < N; ++s) {
+            readers[s] = BitReader(data, size, bitBounds[s]);
+            outs[s] = out + outBounds[s];
+            ends[s] = out + outBounds[s + 1];
+        }
+
+        // HITS table hits per stream write at most 3 * HITS bytes each
+        for (;;) {
+            bool fast = true;
+            for (unsigned s = 0; s < N; ++s) {
+                readers[s].refill();
+                fast = fast && ends[s] - outs[s] >= 3 * HITS && readers[s].position() + 64 <= bitBounds[s + 1];
+            }
+            if (!fast)
+                break;
+            for (unsigned k = 0; k < HITS; ++k) {
+                for (unsigned s = 0; s < N; ++s) {
+                    uint32_t entry = entries[readers[s].peek(bits)];
+                    if (entryCount(entry) == 0) {
+                        // Long code; refill for the table hits that follow
+                        if (decodeOne(readers[s], bitBounds[s + 1], *outs[s]++) != DECODED)
+                            return false;
+                        readers[s].refill();
+                        continue;
+                    }
+                    writeSymbols(entry, outs[s]);
+                    readers[s].consume(entryLength(entry));
+                }
+            }
+        }
+
+        // Finish each stream on its own
+        for (unsigned s = 0; s < N; ++s) {
+            if (readers[s].position() > bitBounds[s + 1] ||
+                !decodeSymbols(data, size, readers[s].position(), bitBounds[s + 1], outs[s], ends[s] - outs[s]))
+                return false;
+        }
+        return true;
+    }
+
+    // Decode the bits of data from bitPosition up to bitEnd, appending the
+    // symbols to out and advancing bitPosition past the last decoded code.
+    // A code running past bitEnd ends decoding. Returns false on an invalid
+    // code.
+    bool decode(const unsigned char* data, size_t size, uint64_t& bitPosition, uint64_t bitEnd,
+                std::string& out) const {
+        BitReader reader(data, size, bitPosition);
+        unsigned char buffer[4096];
+        size_t n = 0;
+
+        for (;;) {
+            if (n > sizeof(buffer) - 3 * HITS - 1) {
+                out.append(reinterpret_cast<char*>(buffer), n);
+                n = 0;
+            }
+            reader.refill();
+            if (reader.position() + 64 <= bitEnd) {
+                // At least 56 bits are buffered, so HITS table hits decode
+                // without touching the input or checking the end
+                unsigned k = 0;
+                unsigned char* out = buffer + n;
+                for (; k < HITS; ++k) {
+                    uint32_t entry = entries[reader.peek(bits)];
+                    if (entryCount(entry) == 0)
+                        break;
+                    writeSymbols(entry, out);
+                    reader.consume(entryLength(entry));
+                }
+                n = out - buffer;
+                if (k == HITS)
+                    continue;
+            }
+
+            bitPosition = reader.position();
+            Status status = decodeOne(reader, bitEnd, buffer[n]);
+            if (status == INVALID)
+                return false;
+            if (status == END)
+                break;
+            n++;
+        }
+        out.append(reinterpret_cast<char*>(buffer), n);
+        return true;
+    }
+
+    // Decode the single symbol at bitPosition and advance bitPosition past
+    // it. Returns false on an invalid code or a code running past bitEnd.
+    bool decodeSymbol(const unsigned char* data, size_t size, uint64_t& bitPosition, uint64_t bitEnd,
+                      unsigned char& symbol) const {
+        BitReader reader(data, size, bitPosition);
+        if (decodeOne(reader, bitEnd, symbol) != DECODED)
+            return false;
+        bitPosition = reader.position();
+        return true;
+    }
+
+private:
+    static const size_t TABLE_SIZE = size_t(1) << BITS;
+    // Table hits between refills, which leave at least 56 bits buffered,
+    // for the widest table
+    static const unsigned HITS = 56 / BITS;
+
+    enum Status { DECODED, END, INVALID };
+
+    // Decode a single symbol, checking every step against bitEnd
+    Status decodeOne(BitReader& reader, uint64_t bitEnd, unsigned char& symbol) const {
+        reader.refill();
+        uint64_t position = reader.position();
+        if (position >= bitEnd)
+            return END;
+
+        size_t index = reader.peek(bits);
+        uint32_t entry = entries[index];
+        unsigned length = firstLengths[index];
+        if (length != 0) {
+            if (position + length > bitEnd)
+                return END;
+            reader.consume(length);
+            symbol = static_cast<unsigned char>(entry >> 8);
+            return DECODED;
+        }
+
+        // Long code: walk the trie one bit at a time
+        int node = entryNode(entry);
+        if (node == 0)
+            return INVALID;
+        if (position + bits > bitEnd)
+            return END;
+        reader.consume(bits);
+        while (node > 0) {
+            if (reader.position() >= bitEnd)
+                return END;
+            reader.refill();
+            node = trie[2 * node + static_cast<int>(reader.peek(1))];
+            reader.consume(1);
+        }
+        if (node == 0)
+            return INVALID;
+        symbol = static_cast<unsigned char>(-node - 1);
+        return DECODED;
+    }
+
+    // Entry layout: bits 0-3 total code length, 4-5 symbol count, 8-15,
+    // 16-23 and 24-31 the symbols. A count of 0 marks a long code and bits
+    // 8-23 then hold its trie node (0 = invalid).
+    static uint32_t makeEntry(unsigned symbol, unsigned length, unsigned count) {
+        return length | count << 4 | symbol << 8;
+    }
+    static unsigned entryLength(uint32_t entry) { return entry & 15; }
+    static unsigned entryCount(uint32_t entry) { return (entry >> 4) & 3; }
+    static int entryNode(uint32_t entry) { return (entry >> 8) & 0xffff; }
+
+    // Store all three symbol bytes and advance out past the valid ones
+    static void writeSymbols(uint32_t entry, unsigned char*& out) {
+        out[0] = static_cast<unsigned char>(entry >> 8);
+        out[1] = static_cast<unsigned char>(entry >> 16);
+        out[2] = static_cast<unsigned char>(entry >> 24);
+        out += entryCount(entry);
+    }
+
+    int newNode() {
+        trie.push_back(0);
+        trie.push_back(0);
+        return static_cast<int>(trie.size() / 2 - 1);
+    }
+
+    unsigned bits; // bits of input indexing the table, at most BITS
+    uint32_t entries[TABLE_SIZE];
+    uint8_t firstLengths[TABLE_SIZE]; // length of the first code, for decoding one symbol
+    // Children of trie node i at [2i] and [2i + 1]: > 0 node, < 0 leaf -(symbol + 1), 0 invalid
+    std::vector<int> trie;
+};
+
+#endif
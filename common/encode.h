@@ -0,0 +1,301 @@
+#ifndef HUFFMAN_ENCODE_H
+#define HUFFMAN_ENCODE_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "bit_io.h"
+#include "container.h"
+#include "histogram.h"
+#include "huffman_code.h"
+#include "huffman_tree.h"
+#include "package_merge.h"
+#include "stats.h"
+
+// Lowest and highest limit accepted for the code length; every byte value
+// still fits in codes of MIN_CODE_LENGTH_LIMIT bits
+const unsigned MIN_CODE_LENGTH_LIMIT = 8;
+const unsigned MAX_CODE_LENGTH_LIMIT = MAX_CODE_LENGTH;
+
+// Code lengths of the Huffman code of a histogram, no longer than
+// maxLength bits. If the Huffman code has longer codes the lengths come
+// from package-merge instead, the best code within the limit. Every byte
+// value that occurs gets a code of its own.
+inline CodeLengths huffmanCodeLengths(const Histogram& histogram, unsigned maxLength = MAX_CODE_LENGTH) {
+    HuffmanTree tree;
+    buildHuffmanTree(histogram.data(), tree);
+    CodeTable codes;
+    assignHuffmanCodes(tree, codes);
+    CodeLengths lengths = codeLengths(codes, histogram.data());
+    if (*std::max_element(lengths.begin(), lengths.end()) > maxLength)
+        packageMergeLengths(histogram.data(), maxLength, lengths);
+    return lengths;
+}
+
+// Append the codes of n bytes of text to the writer
+inline void encodeBytes(const unsigned char* text, size_t n, const CodeTable& codes,
+                        BitWriter& writer) {
+    for (size_t i = 0; i < n; ++i) {
+        const HuffmanCode& code = codes[text[i]];
+        writer.put(code.bits, code.length);
+    }
+}
+
+// Number of bits the codes of a 256-bin byte histogram take
+inline uint64_t encodedBits(const uint64_t* histogram, const CodeTable& codes) {
+    uint64_t bits = 0;
+    for (int symbol = 0; symbol < 256; ++symbol)
+        bits += histogram[symbol] * codes[symbol].length;
+    return bits;
+}
+
+// Encode n bytes of text into data starting at bit `bitOffset`, so that
+// independent pieces of text can be encoded concurrently into one buffer.
+// Only bytes holding no bits of neighbouring pieces are stored whole: the
+// first byte is stored with the bits before bitOffset zeroed, and the last
+// partial byte is returned rather than stored. The caller ORs each returned
+// byte into place once all pieces are done.
+inline unsigned char encodeBytesAt(const unsigned char* text, size_t n, const CodeTable& codes,
+                                   unsigned char* data, uint64_t bitOffset) {
+    BitWriter writer(data, bitOffset);
+    encodeBytes(text, n, codes, writer);
+    return writer.finish();
+}
+
+// Encode block b of the text starting at input byte `base` into data,
+// the block starting at bit `bitOffset` like encodeBytesAt, and record the
+// offset of every stream of the block after the first, whose offset must
+// be in the block index already
+inline unsigned char encodeBlockAt(const unsigned char* text, uint64_t base, const CodeTable& codes,
+                                   ContainerHeader& header, uint64_t b, unsigned char* data, uint64_t bitOffset) {
+    BitWriter writer(data, bitOffset);
+    uint64_t start = writer.position();
+    for (unsigned s = 0; s < header.streams; ++s) {
+        uint64_t begin = header.streamBegin(b, s);
+        if (s > 0)
+            header.blockOffsets[header.streamIndex(b, s)] = header.blockBitBegin(b) + writer.position() - start;
+        encodeBytes(text + (begin - base), header.streamBegin(b, s + 1) - begin, codes, writer);
+    }
+    return writer.finish();
+}
+
+// Encode the blocks of text, one for each histogram and the first of them
+// block firstBlock. The bit length of each block follows from its
+// histogram, so an exclusive prefix sum gives every block its offset and
+// the blocks are encoded in parallel into one shared buffer when built
+// with OpenMP. Block b is coded with codes[header.blockTable(b)].
+// header.bitCount counts the bits encoded so far; data receives the
+// complete bytes from the one holding the old bit count on, and the final
+// partial byte is kept in `carry` for the next call to finish. The time
+// each thread spends encoding goes to threadSeconds if given.
+inline void encodeBlockRange(const unsigned char* text, const std::vector<CodeTable>& codes,
+                             const std::vector<Histogram>& histograms, ContainerHeader& header,
+                             uint64_t firstBlock, unsigned char& carry, std::vector<unsigned char>& data,
+                             std::vector<double>* threadSeconds = nullptr) {
+    int64_t blockCount = histograms.size();
+    uint64_t bitBegin = header.bitCount;
+    std::vector<uint64_t> ends(blockCount);
+    for (int64_t i = 0; i < blockCount; ++i) {
+        header.blockOffsets[header.streamIndex(firstBlock + i, 0)] = header.bitCount;
+        header.bitCount += encodedBits(histograms[i].data(), codes[header.blockTable(firstBlock + i)]);
+        ends[i] = header.bitCount;
+    }
+
+    // data holds the bytes from the one holding bitBegin to the one holding
+    // the new bit count
+    uint64_t base = bitBegin / 8 * 8;
+    data.assign((header.bitCount - base) / 8 + 1, 0);
+    std::vector<unsigned char> tails(blockCount);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int64_t i = 0; i < blockCount; ++i) {
+        ScopedTimer timer(threadSeconds);
+        uint64_t b = firstBlock + i;
+        tails[i] = encodeBlockAt(text, header.blockBegin(firstBlock), codes[header.blockTable(b)], header, b,
+                                 data.data(), header.blockBitBegin(b) - base);
+    }
+
+    // A block ending mid-byte shares that byte with the block after it
+    data[0] |= carry;
+    for (int64_t i = 0; i < blockCount; ++i) {
+        if (ends[i] % 8 != 0)
+            data[(ends[i] - base) / 8] |= tails[i];
+    }
+
+    carry = data.back();
+    data.pop_back();
+}
+
+// Encodes text handed over in pieces and writes the packed bits to out.
+// Each piece is encoded a slice at a time into a fixed buffer, so memory
+// use does not grow with the input.
+class StreamEncoder {
+public:
+    StreamEncoder(const CodeTable& codes, std::ostream& out)
+        : codes(&codes), out(out), buffer(SLICE_SIZE * 8 + 8), writer(buffer.data()), written(0) {}
+
+    // Encode the following pieces with other codes
+    void setCodes(const CodeTable& next) { codes = &next; }
+
+    void encode(const unsigned char* text, size_t n) {
+        for (size_t i = 0; i < n; i += SLICE_SIZE) {
+            encodeBytes(text + i, n - i < SLICE_SIZE ? n - i : SLICE_SIZE, *codes, writer);
+            out.write(reinterpret_cast<const char*>(buffer.data()), writer.size());
+            written += writer.size();
+            writer.rewind();
+        }
+    }
+
+    // Bits encoded so far
+    uint64_t position() const { return written * 8 + writer.position(); }
+
+    // Write the last partial byte and return the number of bits encoded
+    uint64_t finish() {
+        uint64_t bitCount = position();
+        writer.flush();
+        out.write(reinterpret_cast<const char*>(buffer.data()), writer.size());
+        written += writer.size();
+        writer.rewind();
+        return bitCount;
+    }
+
+private:
+    static const size_t SLICE_SIZE = 8192; // codes are at most 64 bits
+
+    const CodeTable* codes;
+    std::ostream& out;
+    std::vector<unsigned char> buffer;
+    BitWriter writer;
+    uint64_t written; // bytes already written to out
+};
+
+// Encode the streams of block b of the text starting at input byte `base`
+// and record where each starts
+inline void encodeBlock(const unsigned char* text, uint64_t base, ContainerHeader& header, uint64_t b,
+                        StreamEncoder& encoder) {
+    for (unsigned s = 0; s < header.streams; ++s) {
+        uint64_t begin = header.streamBegin(b, s);
+        header.blockOffsets[header.streamIndex(b, s)] = encoder.position();
+        encoder.encode(text + (begin - base), header.streamBegin(b, s + 1) - begin);
+    }
+}
+
+// Encode n bytes of text and write the container: header, block index and
+// data. Each block is coded with codes[header.blockTable(b)]. The block
+// index is only known once the data has been written, so the header is
+// written again at the end; out must be seekable.
+inline void encodeContainer(const unsigned char* text, size_t n, const std::vector<CodeTable>& codes,
+                            ContainerHeader& header, std::ostream& out) {
+    header.inputSize = n;
+    header.blockOffsets.assign(header.indexSize(), 0);
+    std::streampos start = out.tellp();
+    writeHeader(out, header);
+    StreamEncoder encoder(codes[0], out);
+    for (uint64_t b = 0; b < header.blockCount(); ++b) {
+        encoder.setCodes(codes[header.blockTable(b)]);
+        encodeBlock(text, 0, header, b, encoder);
+    }
+    header.bitCount = encoder.finish();
+    out.seekp(start);
+    writeHeader(out, header);
+    out.seekp(0, std::ios::end);
+}
+
+// Read up to buffer.size() bytes; returns the number read
+inline size_t readBuffer(std::istream& in, std::vector<unsigned char>& buffer) {
+    in.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    return static_cast<size_t>(in.gcount());
+}
+
+// Bytes from the current position of in to its end, or 0 if in cannot
+// seek, as with a pipe
+inline uint64_t remainingSize(std::istream& in) {
+    std::streampos start = in.tellg();
+    if (start < 0 || !in.seekg(0, std::ios::end)) {
+        in.clear();
+        return 0;
+    }
+    std::streampos end = in.tellg();
+    in.seekg(start);
+    return end > start ? static_cast<uint64_t>(end - start) : 0;
+}
+
+// Read the rest of in into buffer, resized to fit; returns the number of
+// bytes read. Input that cannot seek is read into a buffer that grows
+// until the input ends.
+inline size_t readAll(std::istream& in, std::vector<unsigned char>& buffer) {
+    buffer.resize(remainingSize(in));
+    size_t n = readBuffer(in, buffer);
+    if (n == buffer.size() && in.peek() != std::char_traits<char>::eof()) {
+        while (in) {
+            buffer.resize(std::max(2 * n, STREAM_BUFFER_SIZE));
+            in.read(reinterpret_cast<char*>(buffer.data() + n), buffer.size() - n);
+            n += static_cast<size_t>(in.gcount());
+        }
+    }
+    buffer.resize(n);
+    return n;
+}
+
+// Move the `size` bytes at byte `from` of f up to byte `to`, through
+// buffer, which must not be empty, starting at the end so that the ranges
+// may overlap. Returns false on a read or write error.
+inline bool moveBytesUp(std::iostream& f, uint64_t from, uint64_t to, uint64_t size,
+                        std::vector<unsigned char>& buffer) {
+    for (uint64_t end = size; end > 0;) {
+        uint64_t n = std::min<uint64_t>(buffer.size(), end);
+        end -= n;
+        char* bytes = reinterpret_cast<char*>(buffer.data());
+        if (!f.seekg(static_cast<std::streamoff>(from + end)) || !f.read(bytes, n) ||
+            !f.seekp(static_cast<std::streamoff>(to + end)) || !f.write(bytes, n))
+            return false;
+    }
+    return true;
+}
+
+// Encode the input, the first n bytes of it already in buffer and the rest
+// read from in a buffer at a time until it ends, and write the container.
+// Only the buffer and the encoder's slice are held in memory. The header
+// is sized for header.inputSize bytes of input, 0 if unknown; the real
+// size is only known after the last buffer, and if it is larger the data
+// is moved up to make room for the longer block index. Returns false if
+// the input ends early or out cannot be read back; out must be seekable.
+inline bool encodeStreamContainer(std::istream& in, std::vector<unsigned char>& buffer, size_t n,
+                                  const CodeTable& codes, ContainerHeader& header, std::iostream& out) {
+    uint64_t expected = header.inputSize;
+    header.blockOffsets.assign(header.indexSize(), 0);
+    uint64_t reserved = header.dataOffset();
+    std::streampos start = out.tellp();
+    writeHeader(out, header);
+
+    StreamEncoder encoder(codes, out);
+    uint64_t block = 0;
+    header.inputSize = 0;
+    while (n > 0) {
+        // Buffers hold whole blocks, so only the last block can be short
+        header.inputSize += n;
+        header.blockOffsets.resize(header.indexSize());
+        for (size_t i = 0; i < n; i += header.blockSize)
+            encodeBlock(buffer.data(), header.inputSize - n, header, block++, encoder);
+        n = readBuffer(in, buffer);
+    }
+    header.bitCount = encoder.finish();
+    if (header.inputSize < expected)
+        return false;
+    uint64_t base = static_cast<std::streamoff>(start);
+    if (header.dataOffset() > reserved &&
+        !moveBytesUp(out, base + reserved, base + header.dataOffset(), header.dataSize(), buffer))
+        return false;
+    out.seekp(start);
+    writeHeader(out, header);
+    out.seekp(0, std::ios::end);
+    return true;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef HUFFMAN_HISTOGRAM_H
+#define HUFFMAN_HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "stats.h"
+
+// Byte frequencies, indexed by byte value
+typedef std::array<uint64_t, 256> Histogram;
+
+// Add the byte counts of n bytes of data to histogram. The bytes are read
+// eight at a time and counted into four banks of 32-bit counters, so a run
+// of one byte value increments different counters in turn instead of every
+// increment waiting on the store before it. The banks are added into the
+// 64-bit histogram after every COUNT_BATCH bytes, before a counter can
+// overflow.
+inline void countBytes(const unsigned char* data, size_t n, uint64_t* histogram) {
+    const size_t COUNT_BATCH = size_t(1) << 30;
+    uint32_t banks[4][256];
+    while (n > 0) {
+        size_t batch = n < COUNT_BATCH ? n : COUNT_BATCH;
+        memset(banks, 0, sizeof(banks));
+        size_t i = 0;
+        for (; i + 8 <= batch; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            banks[0][word & 0xff]++;
+            banks[1][(word >> 8) & 0xff]++;
+            banks[2][(word >> 16) & 0xff]++;
+            banks[3][(word >> 24) & 0xff]++;
+            banks[0][(word >> 32) & 0xff]++;
+            banks[1][(word >> 40) & 0xff]++;
+            banks[2][(word >> 48) & 0xff]++;
+            banks[3][word >> 56]++;
+        }
+        for (; i < batch; ++i)
+            banks[0][data[i]]++;
+        for (int symbol = 0; symbol < 256; ++symbol)
+            histogram[symbol] += static_cast<uint64_t>(banks[0][symbol]) + banks[1][symbol] +
+                                 banks[2][symbol] + banks[3][symbol];
+        data += batch;
+        n -= batch;
+    }
+}
+
+// Histograms of the blocks of n bytes of data, blockSize bytes each but the
+// last. Blocks are counted on separate threads when built with OpenMP; the
+// time each thread spends goes to threadSeconds if given.
+inline std::vector<Histogram> countBlockHistograms(const unsigned char* data, size_t n, size_t blockSize,
+                                                   std::vector<double>* threadSeconds = nullptr) {
+    int64_t blockCount = (n + blockSize - 1) / blockSize;
+    std::vector<Histogram> histograms(blockCount);
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int64_t b = 0; b < blockCount; ++b) {
+        ScopedTimer timer(threadSeconds);
+        size_t begin = b * blockSize;
+        histograms[b].fill(0);
+        countBytes(data + begin, (b + 1 < blockCount ? begin + blockSize : n) - begin, histograms[b].data());
+    }
+    return histograms;
+}
+
+// Sum of a set of histograms
+inline Histogram totalHistogram(const std::vector<Histogram>& histograms) {
+    Histogram total = {};
+    for (const Histogram& histogram : histograms) {
+        for (int symbol = 0; symbol < 256; ++symbol)
+            total[symbol] += histogram[symbol];
+    }
+    return total;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HUFFMAN_CODE_H
+#define HUFFMAN_CODE_H
+
+#include <array>
+#include <cstdint>
+
+// A Huffman code stored as an integer: the low `length` bits of `bits`,
+// transmitted most significant bit first. length == 0 means the symbol
+// does not occur.
+struct HuffmanCode {
+    uint64_t bits;
+    uint8_t length;
+};
+
+// Codes indexed by byte value
+typedef std::array<HuffmanCode, 256> CodeTable;
+
+#endif
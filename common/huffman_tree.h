@@ -0,0 +1,95 @@
+#ifndef HUFFMAN_TREE_H
+#define HUFFMAN_TREE_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "huffman_code.h"
+
+// Huffman tree held in a flat array, children referred to by index. The
+// leaves come first, one for every byte value that occurs, in order of
+// increasing frequency; the internal nodes follow in the order they were
+// merged, so the root is the last node.
+struct HuffmanTree {
+    struct Node {
+        uint64_t frequency;
+        int16_t left;  // -1 for a leaf
+        int16_t right;
+        unsigned char symbol;
+    };
+
+    std::array<Node, 511> nodes;
+    int size; // number of nodes, 0 if no byte occurs
+
+    int root() const { return size - 1; }
+    bool isLeaf(int node) const { return nodes[node].left < 0; }
+};
+
+// Build the Huffman tree of a 256-bin histogram. The leaves are sorted once;
+// merged nodes are created in order of increasing frequency as well, so the
+// two lowest nodes are always at the front of either the leaves or the
+// merged nodes and each merge takes constant time (two-queue method). Ties
+// go to the leaf, then to the lower byte value, so the tree only depends on
+// the histogram.
+inline void buildHuffmanTree(const uint64_t* frequencies, HuffmanTree& tree) {
+    std::array<uint16_t, 256> symbols;
+    int leaves = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (frequencies[symbol] != 0)
+            symbols[leaves++] = static_cast<uint16_t>(symbol);
+    }
+    std::sort(symbols.begin(), symbols.begin() + leaves, [frequencies](uint16_t a, uint16_t b) {
+        return frequencies[a] != frequencies[b] ? frequencies[a] < frequencies[b] : a < b;
+    });
+    for (int i = 0; i < leaves; ++i) {
+        HuffmanTree::Node& leaf = tree.nodes[i];
+        leaf.frequency = frequencies[symbols[i]];
+        leaf.left = leaf.right = -1;
+        leaf.symbol = static_cast<unsigned char>(symbols[i]);
+    }
+
+    // Take the lowest unmerged node, from the front of either queue
+    tree.size = leaves;
+    int nextLeaf = 0;
+    int nextMerged = leaves;
+    auto lowest = [&]() -> int16_t {
+        if (nextLeaf < leaves &&
+            (nextMerged == tree.size || tree.nodes[nextLeaf].frequency <= tree.nodes[nextMerged].frequency))
+            return static_cast<int16_t>(nextLeaf++);
+        return static_cast<int16_t>(nextMerged++);
+    };
+    while (tree.size < 2 * leaves - 1) {
+        HuffmanTree::Node& merged = tree.nodes[tree.size];
+        merged.left = lowest();
+        merged.right = lowest();
+        merged.frequency = tree.nodes[merged.left].frequency + tree.nodes[merged.right].frequency;
+        merged.symbol = 0;
+        tree.size++;
+    }
+}
+
+// Codes of the leaves of a tree, indexed by byte value: 0 for a left child,
+// 1 for a right child. Every node comes after its children, so walking the
+// nodes from the root down reaches each node after its parent. Codes longer
+// than 64 bits keep only their length. Bytes that do not occur get length 0,
+// as does the lone leaf of a one-node tree.
+inline void assignHuffmanCodes(const HuffmanTree& tree, CodeTable& codes) {
+    codes.fill(HuffmanCode{0, 0});
+    std::array<HuffmanCode, 511> nodeCodes;
+    if (tree.size > 0)
+        nodeCodes[tree.root()] = HuffmanCode{0, 0};
+    for (int node = tree.root(); node >= 0; --node) {
+        const HuffmanTree::Node& n = tree.nodes[node];
+        const HuffmanCode& code = nodeCodes[node];
+        if (tree.isLeaf(node)) {
+            codes[n.symbol] = code;
+        } else {
+            uint8_t length = static_cast<uint8_t>(code.length + 1);
+            nodeCodes[n.left] = HuffmanCode{code.bits << 1, length};
+            nodeCodes[n.right] = HuffmanCode{code.bits << 1 | 1, length};
+        }
+    }
+}
+
+#endif
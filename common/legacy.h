@@ -0,0 +1,149 @@
+#ifndef HUFFMAN_LEGACY_H
+#define HUFFMAN_LEGACY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "canonical.h"
+#include "decode_table.h"
+
+// Decoding of the original two-file format. The encoded file holds only the
+// packed codes followed by zero padding; the tree file holds the Huffman
+// tree in preorder, '0' for an empty child and '1' plus the node's character
+// otherwise. '~' in the tree stands for a newline.
+//
+// Without a block index nobody knows where a code starts past the first
+// bit, so the data is cut into chunks at byte boundaries and every chunk is
+// decoded speculatively from its cut. A decode started off a code boundary
+// usually falls onto a true boundary within a few symbols and agrees with
+// the true decode from there on, so walking the chunks in order only the
+// symbols before that meeting point have to be redone.
+
+// Assign the codes of the subtree serialized at `index`, whose root has the
+// code `bits` of `length` bits
+inline bool parseLegacySubtree(const std::string& serialized, size_t& index, uint64_t bits,
+                               unsigned length, CodeTable& codes) {
+    if (index >= serialized.size())
+        return false;
+    if (serialized[index] == '0') {
+        index++;
+        return true;
+    }
+    if (serialized[index] != '1' || index + 1 >= serialized.size())
+        return false;
+    unsigned char symbol = static_cast<unsigned char>(serialized[index + 1]);
+    index += 2;
+
+    // A node whose children are both empty is a leaf
+    if (serialized.compare(index, 2, "00") == 0) {
+        index += 2;
+        if (length > 0)
+            codes[symbol == '~' ? '\n' : symbol] = HuffmanCode{bits, static_cast<uint8_t>(length)};
+        return true;
+    }
+    if (length >= MAX_CODE_LENGTH)
+        return false;
+    return parseLegacySubtree(serialized, index, bits << 1, length + 1, codes) &&
+           parseLegacySubtree(serialized, index, bits << 1 | 1, length + 1, codes);
+}
+
+// Codes of a serialized tree. Returns false if the tree is malformed.
+inline bool parseLegacyTree(const std::string& serialized, CodeTable& codes) {
+    codes.fill(HuffmanCode{0, 0});
+    size_t index = 0;
+    return parseLegacySubtree(serialized, index, 0, 0, codes);
+}
+
+// Number of data bits up to and including the last 1 bit. The zero padding
+// cannot be told apart from trailing all-zero codes, so like the original
+// decoders this drops both.
+inline uint64_t legacyBitCount(const unsigned char* data, size_t size) {
+    while (size > 0 && data[size - 1] == 0)
+        size--;
+    if (size == 0)
+        return 0;
+    uint64_t bits = static_cast<uint64_t>(size) * 8;
+    for (unsigned char last = data[size - 1]; (last & 1) == 0; last >>= 1)
+        bits--;
+    return bits;
+}
+
+// Symbols decoded from a guessed start. Codes that start before `end` and
+// finish by it belong to the chunk; the one crossing `end` belongs to the
+// next chunk.
+struct SpeculativeChunk {
+    uint64_t begin; // guessed start, a byte boundary
+    uint64_t end;
+    uint64_t stop;  // bit position after the last decoded code
+    bool valid;     // false if the guessed start ran into an invalid code
+    std::string text;
+};
+
+// Cut the bits [bitBegin, bitEnd) of data into `count` chunks and decode
+// them in parallel, each from the byte boundary it starts on
+inline std::vector<SpeculativeChunk> decodeSpeculative(const DecodeTable& table, const unsigned char* data,
+                                                       size_t size, uint64_t bitBegin, uint64_t bitEnd,
+                                                       int count) {
+    std::vector<SpeculativeChunk> chunks(count);
+    for (int c = 0; c < count; ++c) {
+        uint64_t cut = (bitBegin + (bitEnd - bitBegin) * c / count) / 8 * 8;
+        chunks[c].begin = c == 0 || cut < bitBegin ? bitBegin : cut;
+        if (c > 0)
+            chunks[c - 1].end = chunks[c].begin;
+    }
+    chunks[count - 1].end = bitEnd;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < count; ++c) {
+        SpeculativeChunk& chunk = chunks[c];
+        chunk.stop = chunk.begin;
+        chunk.valid = table.decode(data, size, chunk.stop, chunk.end, chunk.text);
+    }
+    return chunks;
+}
+
+// Correct a speculative chunk once the true position `start` of its first
+// code is known, the stop of the chunk before it. Returns false on an
+// invalid code.
+inline bool resynchronize(const DecodeTable& table, const unsigned char* data, size_t size,
+                          uint64_t start, SpeculativeChunk& chunk) {
+    if (chunk.begin >= chunk.end) {
+        chunk.text.clear();
+        chunk.stop = start;
+        return true;
+    }
+
+    // Step the true decode and the guessed one, always advancing whichever
+    // is behind, until both reach the same code boundary
+    std::string prefix;
+    uint64_t truePosition = start;
+    uint64_t guessPosition = chunk.begin;
+    size_t skipped = 0; // guessed symbols before the meeting point
+    bool synchronized = chunk.valid;
+    while (synchronized && truePosition != guessPosition) {
+        unsigned char symbol;
+        if (truePosition < guessPosition) {
+            synchronized = table.decodeSymbol(data, size, truePosition, chunk.end, symbol);
+            prefix += static_cast<char>(symbol);
+        } else {
+            synchronized = table.decodeSymbol(data, size, guessPosition, chunk.end, symbol);
+            skipped++;
+        }
+    }
+
+    if (synchronized) {
+        chunk.text.replace(0, skipped, prefix);
+    } else {
+        // The two never met inside the chunk; decode it again
+        chunk.text.clear();
+        chunk.stop = start;
+        if (!table.decode(data, size, chunk.stop, chunk.end, chunk.text))
+            return false;
+    }
+    chunk.begin = start;
+    chunk.valid = true;
+    return true;
+}
+
+#endif
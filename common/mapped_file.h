@@ -0,0 +1,69 @@
+#ifndef HUFFMAN_MAPPED_FILE_H
+#define HUFFMAN_MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory map of a whole file, so input is read straight from the
+// page cache instead of being copied into a buffer first. The mapping is
+// advised for sequential access, and for transparent huge pages where the
+// system supports them.
+class MappedFile {
+public:
+    MappedFile() : mapping(nullptr), length(0) {}
+    ~MappedFile() { close(); }
+
+    // Map fileName. An empty file maps to no data. Returns false if the file
+    // cannot be opened or mapped.
+    bool open(const std::string& fileName) {
+        close();
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(status.st_size);
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                return false;
+            }
+            mapping = static_cast<unsigned char*>(p);
+            madvise(mapping, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            madvise(mapping, length, MADV_HUGEPAGE);
+#endif
+        }
+        ::close(fd); // the mapping stays valid
+        return true;
+    }
+
+    void close() {
+        if (mapping != nullptr)
+            munmap(mapping, length);
+        mapping = nullptr;
+        length = 0;
+    }
+
+    const unsigned char* data() const { return mapping; }
+    size_t size() const { return length; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    unsigned char* mapping;
+    size_t length;
+};
+
+#endif
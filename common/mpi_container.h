@@ -0,0 +1,107 @@
+#ifndef HUFFMAN_MPI_CONTAINER_H
+#define HUFFMAN_MPI_CONTAINER_H
+
+#include <mpi.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "container.h"
+#include "encode.h"
+#include "mpi_io.h"
+
+// Encode this process's blocks [firstBlock, firstBlock + histograms.size())
+// of a container split across the processes of comm, as encodeBlockRange
+// does within one process; text holds their input bytes. The bit offset
+// of this process's data is the exclusive prefix sum of the bit lengths of
+// the processes before it. Sets the offsets of these blocks and
+// header.bitCount, the total over all processes, and leaves in bitBegin,
+// bitEnd, data and tail what writeContainerShare takes. Every process must
+// call this.
+inline void encodeRankRange(const unsigned char* text, const std::vector<CodeTable>& codes,
+                            const std::vector<Histogram>& histograms, ContainerHeader& header, uint64_t firstBlock,
+                            uint64_t& bitBegin, uint64_t& bitEnd, std::vector<unsigned char>& data,
+                            unsigned char& tail, MPI_Comm comm, std::vector<double>* threadSeconds = nullptr) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < histograms.size(); ++i)
+        bits += encodedBits(histograms[i].data(), codes[header.blockTable(firstBlock + i)]);
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    bitBegin = 0;
+    MPI_Exscan(&bits, &bitBegin, 1, MPI_UINT64_T, MPI_SUM, comm);
+    if (rank == 0)
+        bitBegin = 0; // MPI_Exscan leaves rank 0's result undefined
+    uint64_t bitCount;
+    MPI_Allreduce(&bits, &bitCount, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    // encodeBlockRange carries on from header.bitCount and keeps the
+    // partial byte it ends on for whoever comes next, here the next process
+    header.bitCount = bitBegin;
+    tail = 0;
+    encodeBlockRange(text, codes, histograms, header, firstBlock, tail, data, threadSeconds);
+    bitEnd = header.bitCount;
+    header.bitCount = bitCount;
+}
+
+// Write a container whose blocks are split across the processes of comm,
+// each process owning the contiguous blocks [firstBlock, lastBlock) and
+// the data bits [bitBegin, bitEnd) they encode to. `data` holds the
+// complete bytes [bitBegin / 8, bitEnd / 8) the process stored, with the
+// bits before bitBegin zero, and `tail` the partial byte at bitEnd / 8.
+//
+// Partial bytes are merged into whichever process stores that byte, then
+// every process writes its own selectors, block index entries and data
+// collectively while process 0 writes the fixed header and code tables.
+// Every process must call this.
+inline bool writeContainerShare(const std::string& fileName, const ContainerHeader& header,
+                                uint64_t firstBlock, uint64_t lastBlock, uint64_t bitBegin,
+                                uint64_t bitEnd, std::vector<unsigned char>& data, unsigned char tail,
+                                MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    std::vector<uint64_t> ends(size);
+    std::vector<unsigned char> tails(size);
+    MPI_Allgather(&bitEnd, 1, MPI_UINT64_T, ends.data(), 1, MPI_UINT64_T, comm);
+    MPI_Allgather(&tail, 1, MPI_UNSIGNED_CHAR, tails.data(), 1, MPI_UNSIGNED_CHAR, comm);
+
+    // The last process also stores the final partial byte of the data
+    uint64_t first = bitBegin / 8;
+    uint64_t last = bitEnd / 8;
+    if (rank == size - 1 && header.bitCount % 8 != 0) {
+        data.push_back(0);
+        last++;
+    }
+    for (int p = 0; p < size; ++p) {
+        uint64_t byte = ends[p] / 8;
+        if (ends[p] % 8 != 0 && byte >= first && byte < last)
+            data[byte - first] |= tails[p];
+    }
+
+    MPI_File file;
+    if (!openForWriteAll(fileName.c_str(), comm, file))
+        return false;
+
+    std::vector<unsigned char> start(header.selectorOffset());
+    serializeHeaderStart(header, start.data());
+    writeAtAll(file, 0, start.data(), rank == 0 ? start.size() : 0, comm);
+
+    if (header.flags & FLAG_MULTI_TABLE) {
+        std::vector<unsigned char> selectors(lastBlock - firstBlock);
+        serializeSelectors(header, firstBlock, lastBlock, selectors.data());
+        writeAtAll(file, header.selectorOffset() + firstBlock, selectors.data(), selectors.size(), comm);
+    }
+
+    std::vector<unsigned char> index(8 * (header.streamIndex(lastBlock, 0) - header.streamIndex(firstBlock, 0)));
+    serializeBlockIndex(header, firstBlock, lastBlock, index.data());
+    writeAtAll(file, header.indexOffset() + 8 * header.streamIndex(firstBlock, 0), index.data(), index.size(),
+               comm);
+
+    writeAtAll(file, header.dataOffset() + first, data.data(), data.size(), comm);
+    return MPI_File_close(&file) == MPI_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef HUFFMAN_MPI_IO_H
+#define HUFFMAN_MPI_IO_H
+
+#include <mpi.h>
+
+#include <cstdint>
+
+// Collective MPI-IO on buffers of any size. MPI counts are int, so larger
+// transfers are split into rounds of at most MPI_IO_CHUNK bytes; every
+// process takes part in the same number of rounds, passing 0 bytes once
+// its own buffer is done.
+
+const uint64_t MPI_IO_CHUNK = uint64_t(1) << 30;
+
+inline uint64_t collectiveRounds(uint64_t size, MPI_Comm comm) {
+    uint64_t rounds = (size + MPI_IO_CHUNK - 1) / MPI_IO_CHUNK;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_UINT64_T, MPI_MAX, comm);
+    return rounds;
+}
+
+// Read size bytes at offset into buffer. Every process of comm must call
+// this on the same file.
+inline void readAtAll(MPI_File file, uint64_t offset, void* buffer, uint64_t size, MPI_Comm comm) {
+    char* p = static_cast<char*>(buffer);
+    uint64_t rounds = collectiveRounds(size, comm);
+    for (uint64_t i = 0, done = 0; i < rounds; ++i) {
+        uint64_t count = size - done < MPI_IO_CHUNK ? size - done : MPI_IO_CHUNK;
+        MPI_File_read_at_all(file, offset + done, p + done, static_cast<int>(count), MPI_BYTE,
+                             MPI_STATUS_IGNORE);
+        done += count;
+    }
+}
+
+// Write size bytes from buffer at offset. Every process of comm must call
+// this on the same file.
+inline void writeAtAll(MPI_File file, uint64_t offset, const void* buffer, uint64_t size, MPI_Comm comm) {
+    const char* p = static_cast<const char*>(buffer);
+    uint64_t rounds = collectiveRounds(size, comm);
+    for (uint64_t i = 0, done = 0; i < rounds; ++i) {
+        uint64_t count = size - done < MPI_IO_CHUNK ? size - done : MPI_IO_CHUNK;
+        MPI_File_write_at_all(file, offset + done, const_cast<char*>(p + done), static_cast<int>(count),
+                              MPI_BYTE, MPI_STATUS_IGNORE);
+        done += count;
+    }
+}
+
+// Open fileName for writing, truncated. Every process of comm must call this.
+inline bool openForWriteAll(const char* fileName, MPI_Comm comm, MPI_File& file) {
+    if (MPI_File_open(comm, const_cast<char*>(fileName), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                      &file) != MPI_SUCCESS)
+        return false;
+    MPI_File_set_size(file, 0);
+    return true;
+}
+
+#endif
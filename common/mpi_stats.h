@@ -0,0 +1,73 @@
+#ifndef HUFFMAN_MPI_STATS_H
+#define HUFFMAN_MPI_STATS_H
+
+#include <mpi.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+// Value of the entry called `name`, 0 if there is none
+inline double statsValue(const std::vector<StatsEntry>& entries, const std::string& name) {
+    for (const StatsEntry& entry : entries) {
+        if (entry.name == name)
+            return entry.total;
+    }
+    return 0;
+}
+
+// Combine the stats of every process of comm into the minimum, maximum
+// and mean of each phase and counter, and have process 0 write the report;
+// a process that skipped a phase counts as 0. The elapsed time is that of
+// the slowest process; the per-thread times are those of process 0. Every
+// process must call this.
+inline void writeStatsAcrossRanks(Stats& stats, const std::string& program, MPI_Comm comm, std::ostream& out) {
+    if (!stats.isEnabled())
+        return;
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // The entries of process 0 name the values every process contributes
+    std::string names;
+    int phaseCount = static_cast<int>(stats.phases().size());
+    for (const StatsEntry& entry : stats.phases())
+        names += entry.name + '\n';
+    for (const StatsEntry& entry : stats.counters())
+        names += entry.name + '\n';
+    int length = static_cast<int>(names.size());
+    MPI_Bcast(&phaseCount, 1, MPI_INT, 0, comm);
+    MPI_Bcast(&length, 1, MPI_INT, 0, comm);
+    names.resize(length);
+    MPI_Bcast(&names[0], length, MPI_CHAR, 0, comm);
+
+    std::vector<std::string> keys;
+    std::vector<double> values;
+    for (size_t begin = 0, end; (end = names.find('\n', begin)) != std::string::npos; begin = end + 1) {
+        keys.push_back(names.substr(begin, end - begin));
+        bool phase = static_cast<int>(keys.size()) <= phaseCount;
+        values.push_back(statsValue(phase ? stats.phases() : stats.counters(), keys.back()));
+    }
+    values.push_back(stats.elapsed());
+
+    int count = static_cast<int>(values.size());
+    std::vector<double> mins(count), maxs(count), totals(count);
+    MPI_Reduce(values.data(), mins.data(), count, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(values.data(), maxs.data(), count, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(values.data(), totals.data(), count, MPI_DOUBLE, MPI_SUM, 0, comm);
+    if (rank != 0)
+        return;
+
+    stats.phases().clear();
+    stats.counters().clear();
+    for (int i = 0; i + 1 < count; ++i) {
+        std::vector<StatsEntry>& entries = i < phaseCount ? stats.phases() : stats.counters();
+        entries.push_back(StatsEntry{keys[i], mins[i], maxs[i], totals[i]});
+    }
+    stats.setRanks(size);
+    stats.writeJson(out, program, maxs[count - 1]);
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef HUFFMAN_MULTI_TABLE_H
+#define HUFFMAN_MULTI_TABLE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "container.h"
+#include "encode.h"
+
+// Block-adaptive coding with several code tables, chosen the way bzip2
+// chooses its selectors. The blocks start out split into runs of
+// consecutive blocks, one run per table. Each round builds every table from
+// the summed histograms of its blocks, then moves each block to the table
+// that codes it in the fewest bits. Every table codes every byte value of
+// the input, so any block can use any table.
+
+const int TABLE_ROUNDS = 4;
+
+// Choose up to tableCount code tables and the table of each block, and
+// store them in the header with FLAG_MULTI_TABLE set. `histograms` are the
+// histograms of blocks [firstBlock, firstBlock + histograms.size()) and
+// `total` that of the whole input. reduce(sums, count) must add up `count`
+// histograms across all processes sharing the input; a single process
+// passes a function that leaves them as they are. Codes are at most
+// maxLength bits long. On return codes[t] holds the encoder codes of table
+// t.
+template <typename Reduce>
+inline void chooseCodeTables(const std::vector<Histogram>& histograms, uint64_t firstBlock,
+                             const Histogram& total, unsigned tableCount, unsigned maxLength, Reduce reduce,
+                             ContainerHeader& header, std::vector<CodeTable>& codes) {
+    uint64_t blockCount = header.blockCount();
+    if (tableCount > MAX_CODE_TABLES)
+        tableCount = MAX_CODE_TABLES;
+    if (tableCount > blockCount)
+        tableCount = blockCount > 0 ? static_cast<unsigned>(blockCount) : 1;
+
+    int64_t count = histograms.size();
+    std::vector<uint8_t> selectors(count);
+    for (int64_t i = 0; i < count; ++i)
+        selectors[i] = static_cast<uint8_t>((firstBlock + i) * tableCount / blockCount);
+
+    std::vector<CodeLengths> lengths(tableCount);
+    codes.resize(tableCount);
+    for (int round = 0; round < TABLE_ROUNDS; ++round) {
+        std::vector<Histogram> sums(tableCount, Histogram());
+        for (int64_t i = 0; i < count; ++i) {
+            for (int symbol = 0; symbol < 256; ++symbol)
+                sums[selectors[i]][symbol] += histograms[i][symbol];
+        }
+        reduce(sums.data(), tableCount);
+        for (unsigned t = 0; t < tableCount; ++t) {
+            for (int symbol = 0; symbol < 256; ++symbol)
+                sums[t][symbol] += total[symbol] != 0 ? 1 : 0;
+            lengths[t] = huffmanCodeLengths(sums[t], maxLength);
+            canonicalCodes(lengths[t], codes[t]);
+        }
+
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+#endif
+        for (int64_t i = 0; i < count; ++i) {
+            uint64_t best = encodedBits(histograms[i].data(), codes[0]);
+            selectors[i] = 0;
+            for (unsigned t = 1; t < tableCount; ++t) {
+                uint64_t bits = encodedBits(histograms[i].data(), codes[t]);
+                if (bits < best) {
+                    best = bits;
+                    selectors[i] = static_cast<uint8_t>(t);
+                }
+            }
+        }
+    }
+
+    header.flags |= FLAG_MULTI_TABLE;
+    header.lengths = lengths[0];
+    header.extraLengths.assign(lengths.begin() + 1, lengths.end());
+    header.selectors.resize(blockCount);
+    for (int64_t i = 0; i < count; ++i)
+        header.selectors[firstBlock + i] = selectors[i];
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef HUFFMAN_OPTIONS_H
+#define HUFFMAN_OPTIONS_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Command line of the form [--name[=value] ...] <argument> ...: options
+// start with "--" and may appear anywhere; everything else is a positional
+// argument.
+class Options {
+public:
+    // Parse argv, accepting only the option names listed in `known` (without
+    // the leading dashes). Returns false on any other option.
+    bool parse(int argc, char* argv[], std::initializer_list<const char*> known) {
+        for (int i = 1; i < argc; ++i) {
+            if (strncmp(argv[i], "--", 2) != 0) {
+                positional.push_back(argv[i]);
+                continue;
+            }
+            std::string option = argv[i] + 2;
+            size_t equals = option.find('=');
+            std::string name = option.substr(0, equals);
+            bool accepted = false;
+            for (const char* candidate : known)
+                accepted = accepted || name == candidate;
+            if (!accepted)
+                return false;
+            values[name] = equals == std::string::npos ? "" : option.substr(equals + 1);
+        }
+        return true;
+    }
+
+    bool has(const std::string& name) const { return values.count(name) != 0; }
+
+    // Value given as --name=value, or `fallback` if absent
+    std::string value(const std::string& name, const std::string& fallback = "") const {
+        std::map<std::string, std::string>::const_iterator it = values.find(name);
+        return it == values.end() ? fallback : it->second;
+    }
+
+    // Value given as --name=value read as a decimal number, or `fallback` if
+    // absent. Returns false if the value is not a number.
+    bool number(const std::string& name, uint64_t fallback, uint64_t& result) const {
+        result = fallback;
+        if (!has(name))
+            return true;
+        std::string text = value(name);
+        char* end;
+        result = strtoull(text.c_str(), &end, 10);
+        return !text.empty() && text[0] != '-' && *end == '\0';
+    }
+
+    const std::vector<std::string>& arguments() const { return positional; }
+
+private:
+    std::vector<std::string> positional;
+    std::map<std::string, std::string> values;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef HUFFMAN_PACKAGE_MERGE_H
+#define HUFFMAN_PACKAGE_MERGE_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "canonical.h"
+
+// Optimal code lengths of at most maxLength bits for a 256-bin histogram,
+// found with the package-merge algorithm. Needs 2^maxLength >= the number
+// of byte values that occur.
+//
+// Every byte value that occurs is a coin of its frequency, available at
+// each of maxLength denominations. Starting from the smallest denomination,
+// the coins are paired off into packages, cheapest first, and the packages
+// merged with the coins of the next denomination. The cheapest 2n - 2
+// items of the last list make up the code: each time a coin of a byte
+// value is among them, directly or inside a package, its code grows by one
+// bit. The items taken from each list are always a prefix of it, twice as
+// many as the packages taken from the list above.
+inline void packageMergeLengths(const uint64_t* frequencies, unsigned maxLength, CodeLengths& lengths) {
+    struct Item {
+        uint64_t weight;
+        int symbol; // -1 for a package
+    };
+
+    lengths.fill(0);
+    std::vector<Item> leaves;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (frequencies[symbol] != 0)
+            leaves.push_back(Item{frequencies[symbol], symbol});
+    }
+    size_t n = leaves.size();
+    if (n == 0)
+        return;
+    if (n == 1) {
+        lengths[leaves[0].symbol] = 1;
+        return;
+    }
+    std::stable_sort(leaves.begin(), leaves.end(),
+                     [](const Item& a, const Item& b) { return a.weight < b.weight; });
+
+    // lists[0] holds the coins of the smallest denomination
+    std::vector<std::vector<Item>> lists(maxLength);
+    lists[0] = leaves;
+    for (unsigned level = 1; level < maxLength; ++level) {
+        const std::vector<Item>& previous = lists[level - 1];
+        std::vector<Item>& list = lists[level];
+        list.reserve(n + previous.size() / 2);
+        size_t leaf = 0;
+        size_t pair = 0;
+        while (leaf < n || pair + 1 < previous.size()) {
+            bool takeLeaf = pair + 1 >= previous.size() ||
+                            (leaf < n && leaves[leaf].weight <= previous[pair].weight + previous[pair + 1].weight);
+            if (takeLeaf) {
+                list.push_back(leaves[leaf++]);
+            } else {
+                list.push_back(Item{previous[pair].weight + previous[pair + 1].weight, -1});
+                pair += 2;
+            }
+        }
+    }
+
+    size_t count = 2 * n - 2;
+    for (unsigned level = maxLength; level-- > 0;) {
+        size_t packages = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (lists[level][i].symbol < 0)
+                packages++;
+            else
+                lengths[lists[level][i].symbol]++;
+        }
+        count = 2 * packages;
+    }
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef HUFFMAN_STATS_H
+#define HUFFMAN_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "container.h"
+
+// Opt-in instrumentation of one run, reported as JSON with --stats=json:
+// the time spent in each phase, counters such as bytes in and out, the
+// code lengths used, and how long each thread worked in a parallel phase.
+// Nothing is recorded until the stats are enabled, so the timers left in
+// place cost one branch otherwise.
+//
+// Under MPI every process keeps its own stats and mpi_stats.h combines
+// them into the minimum, maximum and mean over the processes.
+
+// A phase time in seconds or a counter. Within one process min, max and
+// total are the value itself; across processes they are combined.
+struct StatsEntry {
+    std::string name;
+    double min;
+    double max;
+    double total;
+};
+
+class Stats {
+public:
+    Stats() : enabled(false), ranks(1), start(now()), last(start) {}
+
+    void enable() {
+        enabled = true;
+        start = last = now();
+    }
+    bool isEnabled() const { return enabled; }
+
+    // Seconds from a fixed point in time
+    static double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Add the time since the last recorded phase ended to `phase`
+    void lap(const std::string& phase) {
+        if (enabled)
+            addTime(phase, now() - last);
+    }
+
+    void addTime(const std::string& phase, double seconds) {
+        if (!enabled)
+            return;
+        add(phaseEntries, phase, seconds);
+        last = now();
+    }
+
+    void addCount(const std::string& name, uint64_t count) {
+        if (enabled)
+            add(counterEntries, name, static_cast<double>(count));
+    }
+
+    // Count the bytes a process read and wrote
+    void addBytes(uint64_t in, uint64_t out) {
+        addCount("bytes_in", in);
+        addCount("bytes_out", out);
+    }
+
+    // Add the busy time of each thread in a parallel phase
+    void addThreadTimes(const std::string& phase, const std::vector<double>& seconds) {
+        if (!enabled)
+            return;
+        size_t i = 0;
+        while (i < threadPhases.size() && threadPhases[i] != phase)
+            i++;
+        if (i == threadPhases.size()) {
+            threadPhases.push_back(phase);
+            threadSeconds.push_back(std::vector<double>());
+        }
+        std::vector<double>& times = threadSeconds[i];
+        times.resize(std::max(times.size(), seconds.size()));
+        for (size_t t = 0; t < seconds.size(); ++t)
+            times[t] += seconds[t];
+    }
+
+    // Record the code lengths and the bits per input byte of a container
+    void setCodeLengths(const ContainerHeader& header) {
+        if (!enabled)
+            return;
+        codeHeader = header;
+        codeHeader.blockOffsets.clear();
+        codeHeader.selectors.clear();
+    }
+
+    std::vector<StatsEntry>& phases() { return phaseEntries; }
+    std::vector<StatsEntry>& counters() { return counterEntries; }
+    double elapsed() const { return now() - start; }
+
+    // Number of processes the entries were combined over
+    void setRanks(int count) { ranks = count; }
+
+    // Write the report. With one process every entry is a plain number,
+    // otherwise an object holding its minimum, maximum and mean.
+    void writeJson(std::ostream& out, const std::string& program, double elapsedSeconds) const {
+        out << std::fixed << std::setprecision(6);
+        out << "{" << std::endl;
+        out << "  \"program\": \"" << program << "\"," << std::endl;
+        if (ranks > 1)
+            out << "  \"ranks\": " << ranks << "," << std::endl;
+        out << "  \"elapsed_seconds\": " << elapsedSeconds << "," << std::endl;
+        writeEntries(out, "phase_seconds", phaseEntries, false);
+        out << "," << std::endl;
+        writeEntries(out, "counters", counterEntries, true);
+        out << "," << std::endl;
+        writeCodeLengths(out);
+        if (!threadPhases.empty()) {
+            out << "," << std::endl << "  \"thread_seconds\": {";
+            for (size_t i = 0; i < threadPhases.size(); ++i) {
+                out << (i ? ", " : "") << "\"" << threadPhases[i] << "\": [";
+                for (size_t t = 0; t < threadSeconds[i].size(); ++t)
+                    out << (t ? ", " : "") << threadSeconds[i][t];
+                out << "]";
+            }
+            out << "}";
+        }
+        out << std::endl << "}" << std::endl;
+    }
+
+private:
+    static void add(std::vector<StatsEntry>& entries, const std::string& name, double value) {
+        for (StatsEntry& entry : entries) {
+            if (entry.name == name) {
+                entry.min = entry.max = entry.total = entry.total + value;
+                return;
+            }
+        }
+        entries.push_back(StatsEntry{name, value, value, value});
+    }
+
+    // Counts are written as whole numbers, except for their means
+    void writeEntries(std::ostream& out, const char* name, const std::vector<StatsEntry>& entries,
+                      bool counts) const {
+        out << "  \"" << name << "\": {";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const StatsEntry& entry = entries[i];
+            out << (i ? "," : "") << std::endl << "    \"" << entry.name << "\": ";
+            if (ranks > 1) {
+                out << "{\"min\": ";
+                writeNumber(out, entry.min, counts);
+                out << ", \"max\": ";
+                writeNumber(out, entry.max, counts);
+                out << ", \"mean\": " << entry.total / ranks << "}";
+            } else {
+                writeNumber(out, entry.total, counts);
+            }
+        }
+        out << (entries.empty() ? "}" : "\n  }");
+    }
+
+    static void writeNumber(std::ostream& out, double value, bool count) {
+        if (count)
+            out << static_cast<uint64_t>(value);
+        else
+            out << value;
+    }
+
+    // Tables, byte values with a code, shortest and longest code and the
+    // mean bits per input byte
+    void writeCodeLengths(std::ostream& out) const {
+        unsigned symbols = 0, shortest = 0, longest = 0;
+        for (unsigned t = 0; t < codeHeader.tableCount(); ++t) {
+            const CodeLengths& lengths = codeHeader.tableLengths(t);
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                unsigned length = lengths[symbol];
+                if (length == 0)
+                    continue;
+                if (t == 0)
+                    symbols++;
+                shortest = shortest == 0 ? length : std::min(shortest, length);
+                longest = std::max(longest, length);
+            }
+        }
+        double bitsPerByte =
+            codeHeader.inputSize ? static_cast<double>(codeHeader.bitCount) / codeHeader.inputSize : 0;
+        out << "  \"code_lengths\": {\"tables\": " << codeHeader.tableCount() << ", \"streams\": "
+            << codeHeader.streams << ", \"symbols\": " << symbols << ", \"min\": " << shortest
+            << ", \"max\": " << longest << ", \"bits_per_byte\": " << bitsPerByte << "}";
+    }
+
+    bool enabled;
+    int ranks;
+    double start;
+    double last;
+    std::vector<StatsEntry> phaseEntries;
+    std::vector<StatsEntry> counterEntries;
+    std::vector<std::string> threadPhases;
+    std::vector<std::vector<double>> threadSeconds;
+    ContainerHeader codeHeader;
+};
+
+// Adds the time from its construction to its destruction to the calling
+// thread's entry of `seconds`, which holds the busy time of every thread in
+// a parallel phase for Stats::addThreadTimes. Given no vector, as when the
+// stats are disabled, it records nothing.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(std::vector<double>* seconds) : seconds(seconds), start(seconds ? Stats::now() : 0) {}
+    ~ScopedTimer() {
+        if (!seconds)
+            return;
+#ifdef _OPENMP
+        (*seconds)[omp_get_thread_num()] += Stats::now() - start;
+#else
+        (*seconds)[0] += Stats::now() - start;
+#endif
+    }
+
+private:
+    ScopedTimer(const ScopedTimer&);
+    ScopedTimer& operator=(const ScopedTimer&);
+
+    std::vector<double>* seconds;
+    double start;
+};
+
+// Check a --stats option; json is the only report format
+inline bool statsOption(const std::string& value, Stats& stats) {
+    if (value != "json")
+        return false;
+    stats.enable();
+    return true;
+}
+
+#endif
@@ -1,118 +1,233 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <map>
-#include <bitset>
 #include <mpi.h>
 #include <ctime>
 #include <vector>
 #include <omp.h>
 
-using namespace std;
-
-// Node for Huffman Tree
-struct Node {
-    char data;
-    Node* left;
-    Node* right;
+#include "../common/codebook.h"
+#include "../common/container.h"
+#include "../common/mapped_file.h"
+#include "../common/mpi_io.h"
+#include "../common/mpi_stats.h"
+#include "../common/options.h"
+#include "../common/legacy.h"
 
-    Node(char data) {
-        this->data = data;
-        left = right = nullptr;
-    }
-};
-
-// Deserialize Huffman Tree from serialized string
-Node* deserializeHuffmanTree(string& serializedTree, size_t& index) {
-    if (index >= serializedTree.size())
-        return nullptr;
+using namespace std;
 
-    if (serializedTree[index] == '0') {
-        index++;
-        return nullptr;
+// Decode text using the Huffman decode tables. Every block starts at a bit
+// offset recorded in the block index and decodes to a known slice of the
+// output, so this process's threads decode whole blocks independently.
+// data holds size encoded bytes from data byte dataBegin on. The time each
+// thread spends decoding goes to the stats. Returns false on an invalid
+// code.
+bool decodeText(const unsigned char* data, size_t size, uint64_t dataBegin, const ContainerHeader& header,
+                const DecodeTables& tables, uint64_t firstBlock, uint64_t lastBlock, string& decodedText,
+                Stats& stats) {
+    if (firstBlock >= lastBlock)
+        return true;
+    decodedText.assign(header.blockEnd(lastBlock - 1) - header.blockBegin(firstBlock), '\0');
+    unsigned char* out = reinterpret_cast<unsigned char*>(&decodedText[0]);
+    bool valid = true;
+    vector<double> threadSeconds(omp_get_max_threads());
+    vector<double>* threadTimes = stats.isEnabled() ? &threadSeconds : nullptr;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&& : valid)
+    for (int64_t b = firstBlock; b < static_cast<int64_t>(lastBlock); ++b) {
+        ScopedTimer timer(threadTimes);
+        valid = decodeBlocks(header, tables, data, size, dataBegin, b, b + 1,
+                             out + (header.blockBegin(b) - header.blockBegin(firstBlock))) && valid;
     }
+    stats.addThreadTimes("decode", threadSeconds);
+    return valid;
+}
 
-    index++;
-    Node* root = new Node(serializedTree[index]);
-    index++;
-
-#pragma omp task shared(root, serializedTree, index)
-   root->left = deserializeHuffmanTree(serializedTree, index);
+// Read the bytes holding the bits of blocks [firstBlock, lastBlock) into
+// buffer; start is the data byte they begin at
+bool readBinaryData(ifstream& encodedFile, const ContainerHeader& header, uint64_t firstBlock, uint64_t lastBlock,
+                    vector<unsigned char>& buffer, uint64_t& start) {
+    if (firstBlock >= lastBlock)
+        return true;
+    start = header.blockBitBegin(firstBlock) / 8;
+    uint64_t end = (header.blockBitEnd(lastBlock - 1) + 7) / 8;
+    encodedFile.seekg(header.dataOffset() + start); // Move file pointer to start position
+    buffer.resize(end - start);
+    return !encodedFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size()).fail();
+}
 
+// Whether passed holds on every process. Every process must call this, so
+// that a failure on any of them stops them all together; process 0 reports
+// it.
+bool passedEverywhere(bool passed, const string& error, int rank) {
+    int all = passed;
+    MPI_Allreduce(MPI_IN_PLACE, &all, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (!all && rank == 0)
+        cerr << "Error: " << error << endl;
+    return all;
+}
 
-#pragma omp task shared(root, serializedTree, index)
-    root->right = deserializeHuffmanTree(serializedTree, index);
+// Decode this process's share of a container file, a contiguous range of
+// blocks from the block index. A mapped file is decoded in place. Given a
+// codebook, the file must have been coded with it and is decoded with its
+// decode table. Every process returns false together on failure.
+bool decodeContainerFile(const string& encodedFileName, bool mapped, const Codebook* codebook, int rank, int size,
+                         string& decodedText, Stats& stats) {
+    // Read the container header and rebuild the decode tables
+    ifstream encodedFile;
+    MappedFile mappedFile;
+    bool opened;
+    if (mapped) {
+        opened = mappedFile.open(encodedFileName);
+    } else {
+        encodedFile.open(encodedFileName, ios::binary); // Open encoded file in binary mode
+        opened = encodedFile.is_open();
+    }
+    if (!passedEverywhere(opened, "Unable to open encoded file: " + encodedFileName, rank))
+        return false;
+    ContainerHeader header;
+    DecodeTables builtTables;
+    bool valid = mapped ? parseHeader(mappedFile.data(), mappedFile.size(), header)
+                        : readHeader(encodedFile, header);
+    valid = valid && (codebook || buildDecodeTables(header, builtTables));
+    if (!passedEverywhere(valid, "Invalid encoded file: " + encodedFileName, rank) ||
+        !passedEverywhere(!codebook || codedWith(header, *codebook),
+                          "Encoded file was not coded with the codebook: " + encodedFileName, rank))
+        return false;
+    const DecodeTables& tables = codebook ? codebook->tables : builtTables;
+    stats.lap("parse");
+
+    // Assign a contiguous range of blocks to each process
+    uint64_t blockCount = header.blockCount();
+    uint64_t firstBlock = blockCount * rank / size;
+    uint64_t lastBlock = blockCount * (rank + 1) / size;
+
+    // Read this process's blocks, unless they are decoded in place
+    vector<unsigned char> buffer;
+    uint64_t start = 0;
+    if (!mapped) {
+        bool read = readBinaryData(encodedFile, header, firstBlock, lastBlock, buffer, start);
+        encodedFile.close();
+        if (!passedEverywhere(read, "Unable to read encoded file: " + encodedFileName, rank))
+            return false;
+        stats.lap("read");
+    }
 
-#pragma omp taskwait
-    return root;
+    // Decode this process's blocks
+    bool decoded = mapped ? decodeText(mappedFile.data() + header.dataOffset(), header.dataSize(), 0, header,
+                                       tables, firstBlock, lastBlock, decodedText, stats)
+                          : decodeText(buffer.data(), buffer.size(), start, header, tables, firstBlock, lastBlock,
+                                       decodedText, stats);
+    if (!passedEverywhere(decoded, "Invalid Huffman code", rank))
+        return false;
+    stats.lap("decode");
+    uint64_t encodedSize =
+        firstBlock < lastBlock ? (header.blockBitEnd(lastBlock - 1) + 7) / 8 - header.blockBitBegin(firstBlock) / 8 : 0;
+    stats.addCount("bytes_in", encodedSize);
+    stats.addCount("blocks", lastBlock - firstBlock);
+    stats.setCodeLengths(header);
+    return true;
 }
 
-// Decode text using Huffman Tree and Huffman codes
-string decodeText(string binaryString, Node* root) {
-    string decodedText = "";
-    Node* current = root;
-    for (char bit : binaryString) {
-        if (bit == '0') {
-            current = current->left;
-        } else {
-            current = current->right;
-        }
+// Decode this process's share of a file in the original format. Every
+// process decodes a byte range in speculative chunks on its threads; the
+// processes then resynchronize in rank order, each passing the position
+// after its last code on to the next. Every process returns false together
+// on failure.
+bool decodeLegacyFile(const string& encodedFileName, const string& treeFileName, bool mapped, int rank, int size,
+                      string& decodedText, Stats& stats) {
+    // Read serialized Huffman tree
+    ifstream treeFile(treeFileName);
+    if (!passedEverywhere(treeFile.is_open(), "Unable to open Huffman tree file: " + treeFileName, rank))
+        return false;
+    string serializedTree;
+    getline(treeFile, serializedTree);
+    treeFile.close();
 
-        if (current->left == nullptr && current->right == nullptr) {
-            if (current->data != '~')
-                decodedText += current->data;
-            else
-                decodedText += '\n';
-            current = root;
+    CodeTable codes;
+    DecodeTable table;
+    bool parsed = parseLegacyTree(serializedTree, codes) && table.build(codes);
+    if (!passedEverywhere(parsed, "Invalid Huffman tree file: " + treeFileName, rank))
+        return false;
+
+    ifstream encodedFile;
+    MappedFile mappedFile;
+    bool opened;
+    if (mapped) {
+        opened = mappedFile.open(encodedFileName);
+    } else {
+        encodedFile.open(encodedFileName, ios::binary);
+        opened = encodedFile.is_open();
+    }
+    if (!passedEverywhere(opened, "Unable to open encoded file: " + encodedFileName, rank))
+        return false;
+
+    // Calculate chunk size for each process. The code crossing into the
+    // range starts at most MAX_CODE_LENGTH bits before it, so those bytes
+    // are read as well, or looked at in place in a mapped file.
+    uint64_t fileSize = mappedFile.size();
+    bool sized = true;
+    if (!mapped) {
+        // A directory opens, but fails the first read and then has no size
+        encodedFile.peek();
+        encodedFile.seekg(0, ios::end);
+        streamoff end = encodedFile.tellg();
+        sized = end >= 0;
+        fileSize = sized ? end : 0;
+    }
+    if (!passedEverywhere(sized, "Unable to read encoded file: " + encodedFileName, rank))
+        return false;
+    uint64_t first = fileSize * rank / size;
+    uint64_t last = fileSize * (rank + 1) / size;
+    uint64_t base = first < MAX_CODE_LENGTH / 8 ? 0 : first - MAX_CODE_LENGTH / 8;
+    vector<unsigned char> buffer;
+    bool read = true;
+    if (!mapped) {
+        buffer.resize(last - base);
+        encodedFile.seekg(base);
+        read = !encodedFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size()).fail();
+        encodedFile.close();
+    }
+    if (!passedEverywhere(read, "Unable to read encoded file: " + encodedFileName, rank))
+        return false;
+    const unsigned char* data = mapped ? mappedFile.data() + base : buffer.data();
+    size_t dataSize = last - base;
+    stats.lap("read");
+    stats.addCount("bytes_in", last - first);
+
+    // The codes end at the last 1 bit of the whole file
+    uint64_t localBits = legacyBitCount(data + (first - base), last - first);
+    uint64_t bitCount = localBits ? 8 * first + localBits : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &bitCount, 1, MPI_UINT64_T, MPI_MAX, MPI_COMM_WORLD);
+
+    // Bit positions below are relative to the start of data
+    uint64_t limit = max(bitCount, 8 * base);
+    uint64_t bitBegin = min(8 * first, limit) - 8 * base;
+    uint64_t bitEnd = min(8 * last, limit) - 8 * base;
+    vector<SpeculativeChunk> chunks =
+        decodeSpeculative(table, data, dataSize, bitBegin, bitEnd, 4 * omp_get_max_threads());
+    stats.lap("decode");
+
+    // Wait for the previous process to find where its last code ends
+    uint64_t start = 0;
+    if (rank > 0)
+        MPI_Recv(&start, 1, MPI_UINT64_T, rank - 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    bool valid = true;
+    if (bitBegin < bitEnd) {
+        start -= 8 * base;
+        for (SpeculativeChunk& chunk : chunks) {
+            valid = valid && resynchronize(table, data, dataSize, start, chunk);
+            start = chunk.stop;
+            decodedText += chunk.text;
         }
+        start += 8 * base;
     }
-    return decodedText;
-}
+    if (rank + 1 < size)
+        MPI_Send(&start, 1, MPI_UINT64_T, rank + 1, 0, MPI_COMM_WORLD);
+    stats.lap("resynchronize");
 
-string decodeBinaryData(ifstream &encodedFile, Node *root, size_t start, size_t end) {
-
-  int p = omp_get_max_threads();
-
-  string binaryStrings[p];
-  int i;
-  for (i = 0; i < p; i++) {
-    binaryStrings[i] = "";
-  }
-  string binaryString = "";
-
-  encodedFile.seekg(start); // Move file pointer to start position
-  size_t fileSize = end - start;
-
-  // Read binary data from file
-  char *buffer = new char[fileSize];
-  encodedFile.read(buffer, fileSize);
-  encodedFile.close();
-
-// Convert binary data to binary string
-#pragma omp parallel for firstprivate(buffer)
-  for (size_t i = 0; i < fileSize; ++i) {
-    bitset<8> bits(
-        static_cast<unsigned char>(buffer[i])); // Convert each byte to binary
-    binaryStrings[omp_get_thread_num()] += bits.to_string();
-  }
-
-  delete[] buffer;
-
-  for (i = 0; i < p; i++) {
-    binaryString += binaryStrings[i];
-  }
-
-  // Find the position of the last non-zero bit
-  size_t lastNonZeroPos = binaryString.find_last_not_of('0');
-  if (lastNonZeroPos != string::npos) {
-    binaryString.resize(lastNonZeroPos + 1); // Remove trailing zeros
-  } else {
-    binaryString.clear(); // Handle case where the string is all zeros
-  }
-
-  // Decode binary string using Huffman Tree
-  string decodedText = decodeText(binaryString, root);
-  
-  return decodedText;
+    return passedEverywhere(valid, "Invalid Huffman code", rank);
 }
 
 int main(int argc, char* argv[]) {
@@ -122,82 +237,70 @@ int main(int argc, char* argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 4) {
-        cerr << "Usage: " << argv[0] << " <encoded_file> <tree_file> <output_file>" << endl;
+    Options options;
+    Stats stats;
+    bool parsed = options.parse(argc, argv, {"legacy", "mmap", "stats", "codebook"});
+    bool legacy = options.has("legacy");
+    const vector<string>& arguments = options.arguments();
+    if (!parsed || arguments.size() != (legacy ? 3u : 2u) || (legacy && options.has("codebook")) ||
+        (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+        if (rank == 0) {
+            cerr << "Usage: " << argv[0] << " [--mmap] [--codebook=FILE] [--stats=json] <encoded_file> <output_file>"
+                 << endl;
+            cerr << "       " << argv[0]
+                 << " --legacy [--mmap] [--stats=json] <encoded_file> <tree_file> <output_file>" << endl;
+            cerr << "       FILE the codebook the file was encoded with" << endl;
+            cerr << "       --stats=json reports phase times and counters over all processes on stderr" << endl;
+        }
+        MPI_Finalize();
         return 1;
     }
 
     double startTime = MPI_Wtime();
 
-    string encodedFileName = argv[1];
-    string treeFileName = argv[2];
-    string outputFileName = argv[3];
+    bool mapped = options.has("mmap");
+    string encodedFileName = arguments.front();
+    string outputFileName = arguments.back();
 
-    // Read serialized Huffman tree
-    ifstream treeFile(treeFileName);
-    if (!treeFile) {
-        cerr << "Error: Unable to open Huffman tree file: " << treeFileName << endl;
+    // The decode table of a codebook serves every file coded with it
+    Codebook codebook;
+    bool shared = options.has("codebook");
+    bool loaded = !shared || readCodebook(options.value("codebook"), codebook);
+    if (!passedEverywhere(loaded, "Invalid codebook file: " + options.value("codebook"), rank)) {
+        MPI_Finalize();
         return 1;
     }
-    string serializedTree;
-    getline(treeFile, serializedTree);
-    treeFile.close();
-
-    // Deserialize Huffman tree
-    size_t index = 0;
-    Node* root = deserializeHuffmanTree(serializedTree, index);
 
-    // Read encoded text from file
-    ifstream encodedFile(encodedFileName, ios::binary); // Open encoded file in binary mode
-    if (!encodedFile) {
-        cerr << "Error: Unable to open encoded file: " << encodedFileName << endl;
+    // Decode this process's share of the file
+    string decodedText;
+    bool decoded = legacy ? decodeLegacyFile(encodedFileName, arguments[1], mapped, rank, size, decodedText, stats)
+                          : decodeContainerFile(encodedFileName, mapped, shared ? &codebook : nullptr, rank, size,
+                                                decodedText, stats);
+    if (!decoded) {
+        MPI_Finalize();
         return 1;
     }
 
-    // Calculate chunk size for each process
-    encodedFile.seekg(0, ios::end);
-    size_t fileSize = encodedFile.tellg();
-    size_t chunkSize = fileSize / size;
-    size_t start = rank * chunkSize;
-    size_t end = (rank == size - 1) ? fileSize : (rank + 1) * chunkSize;
-
-    // Decode binary data using Huffman Tree
-    string decodedText = decodeBinaryData(encodedFile, root, start, end);
-    
-    int decodedsize = decodedText.size();
-     
-    // Gather the sizes of decoded text from all processes
-    vector<int> recvCounts(size);
-    
-    MPI_Gather(&decodedsize, 1, MPI_INT, recvCounts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // Calculate the displacement for the gathered data
-    vector<int> displs(size, 0);
-    for (int i = 1; i < size; i++) {
-        displs[i] = displs[i - 1] + recvCounts[i - 1];
-    }
-
-    // Gather decoded text from all processes to process 0
-    string totalDecodedText;
-    if (rank == 0) {
-        totalDecodedText.resize(displs[size - 1] + recvCounts[size - 1]);
-    }
-
-    MPI_Gatherv(decodedText.data(), decodedText.size(), MPI_CHAR, &totalDecodedText[0], recvCounts.data(), displs.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
+    // Each process writes its decoded text after that of the processes before it
+    uint64_t decodedSize = decodedText.size();
+    uint64_t outputOffset = 0;
+    MPI_Exscan(&decodedSize, &outputOffset, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0)
+        outputOffset = 0; // MPI_Exscan leaves rank 0's result undefined
 
     // Write decoded text to output file
-    if (rank == 0) {
-        ofstream outputFile(outputFileName);
-        if (!outputFile) {
+    MPI_File outputFile;
+    if (!openForWriteAll(outputFileName.c_str(), MPI_COMM_WORLD, outputFile)) {
+        if (rank == 0)
             cerr << "Error: Unable to open output file: " << outputFileName << endl;
-            return 1;
-        }
-        outputFile << totalDecodedText;
-        outputFile.close();
-
-        // Release memory
-        delete root;
+        MPI_Finalize();
+        return 1;
+    }
+    writeAtAll(outputFile, outputOffset, decodedText.data(), decodedSize, MPI_COMM_WORLD);
+    MPI_File_close(&outputFile);
+    stats.lap("write");
 
+    if (rank == 0) {
         double endTime = MPI_Wtime();
         double elapsedTime = endTime - startTime;
 
@@ -205,6 +308,12 @@ int main(int argc, char* argv[]) {
         cout << "Time taken: " << elapsedTime << " seconds" << endl;
     }
 
+    // Counters are per process: the encoded bytes it decoded and the text
+    // they decode to
+    stats.addCount("bytes_out", decodedSize);
+    stats.addCount("threads", omp_get_max_threads());
+    writeStatsAcrossRanks(stats, "decode_mpi_openmp", MPI_COMM_WORLD, cerr);
+
     MPI_Finalize();
 
     return 0;
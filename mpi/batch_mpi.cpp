@@ -0,0 +1,333 @@
+#include <mpi.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/batch.h"
+#include "../common/codebook.h"
+#include "../common/mpi_container.h"
+#include "../common/multi_table.h"
+#include "../common/options.h"
+
+using namespace std;
+
+// Encode or decode a batch of files over many processes. Process 0 collects
+// the files, largest first. A file larger than an even share of the batch
+// would leave the other processes idle while one codes it, so such files
+// are coded by every process together, each taking a contiguous range of
+// blocks as encode_mpi and decode_mpi do. The rest are handed out one at a
+// time to whichever process is free next, process 0 included, so a process
+// that drew a large file is not also left with its share of the rest.
+// Every process keeps one Codec for the whole batch; built with -fopenmp,
+// a file's blocks are also spread over the process's threads.
+
+// Send the batch from process 0 to every process. A negative count tells
+// the others that process 0 could not make the batch.
+bool broadcastBatch(vector<BatchFile>& files, bool made, int my_rank) {
+    int64_t count = made ? static_cast<int64_t>(files.size()) : -1;
+    MPI_Bcast(&count, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    if (count < 0)
+        return false;
+
+    // Inputs and outputs joined by newlines, then the sizes
+    string names;
+    if (my_rank == 0) {
+        for (const BatchFile& file : files)
+            names += file.input + '\n' + file.output + '\n';
+    }
+    uint64_t length = names.size();
+    MPI_Bcast(&length, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    names.resize(length);
+    MPI_Bcast(&names[0], static_cast<int>(length), MPI_CHAR, 0, MPI_COMM_WORLD);
+    vector<uint64_t> sizes(count);
+    for (int64_t i = 0; my_rank == 0 && i < count; ++i)
+        sizes[i] = files[i].size;
+    MPI_Bcast(sizes.data(), static_cast<int>(count), MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    if (my_rank != 0) {
+        files.resize(count);
+        size_t begin = 0;
+        for (int64_t i = 0; i < count; ++i) {
+            size_t end = names.find('\n', begin);
+            files[i].input = names.substr(begin, end - begin);
+            begin = end + 1;
+            end = names.find('\n', begin);
+            files[i].output = names.substr(begin, end - begin);
+            begin = end + 1;
+            files[i].size = sizes[i];
+        }
+    }
+    return true;
+}
+
+// Blocks [firstBlock, lastBlock) of a container with blockCount blocks
+// that this process codes
+void blockRange(uint64_t blockCount, uint64_t& firstBlock, uint64_t& lastBlock) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    firstBlock = blockCount * rank / size;
+    lastBlock = blockCount * (rank + 1) / size;
+}
+
+// Whether `passed` holds on every process
+bool passedEverywhere(bool passed) {
+    int all = passed;
+    MPI_Allreduce(MPI_IN_PLACE, &all, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    return all != 0;
+}
+
+// Encode one file with every process coding a range of its blocks, into
+// the same container the Codec writes, and add its size after to bytesOut.
+// Returns a description of what went wrong, the same on every process, or
+// nullptr. Every process must call this.
+const char* encodeSharedFile(const BatchFile& file, const CodecOptions& options, const Codebook* codebook,
+                             uint64_t& bytesOut) {
+    MappedFile input;
+    if (!passedEverywhere(input.open(file.input)))
+        return "Unable to open input file";
+    ContainerHeader header;
+    header.inputSize = input.size();
+    header.blockSize = options.blockSize;
+    header.setStreams(options.streams);
+    header.blockOffsets.assign(header.indexSize(), 0);
+    uint64_t firstBlock, lastBlock;
+    blockRange(header.blockCount(), firstBlock, lastBlock);
+    const unsigned char* chunk = input.data() + (firstBlock < lastBlock ? header.blockBegin(firstBlock) : 0);
+    uint64_t chunkSize = firstBlock < lastBlock ? header.blockEnd(lastBlock - 1) - header.blockBegin(firstBlock) : 0;
+
+    // Every process builds the same codes from the histogram of the whole
+    // file, or takes them from the codebook
+    std::vector<Histogram> histograms = countBlockHistograms(chunk, chunkSize, header.blockSize);
+    std::vector<CodeTable> codes(1);
+    if (codebook) {
+        useCodebook(*codebook, header);
+        codes[0] = codebook->codes;
+    } else {
+        Histogram local = totalHistogram(histograms);
+        Histogram total;
+        MPI_Allreduce(local.data(), total.data(), 256, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        header.lengths = huffmanCodeLengths(total, options.maxCodeLength);
+        canonicalCodes(header.lengths, codes[0]);
+        if (options.tables > 1) {
+            auto sumOverProcesses = [](Histogram* sums, unsigned count) {
+                MPI_Allreduce(MPI_IN_PLACE, sums->data(), 256 * count, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+            };
+            chooseCodeTables(histograms, firstBlock, total, options.tables, options.maxCodeLength, sumOverProcesses,
+                             header, codes);
+        }
+    }
+
+    uint64_t bitBegin, bitEnd;
+    std::vector<unsigned char> data;
+    unsigned char tail;
+    encodeRankRange(chunk, codes, histograms, header, firstBlock, bitBegin, bitEnd, data, tail, MPI_COMM_WORLD);
+    if (!passedEverywhere(writeContainerShare(file.output, header, firstBlock, lastBlock, bitBegin, bitEnd, data,
+                                              tail, MPI_COMM_WORLD)))
+        return "Unable to write output file";
+    bytesOut += header.dataOffset() + header.dataSize();
+    return nullptr;
+}
+
+// Decode one file with every process decoding a range of its blocks and
+// writing them in place, and add its size after to bytesOut. A file
+// decoded with a codebook must have been coded with it. Returns a
+// description of what went wrong, the same on every process, or nullptr.
+// Every process must call this.
+const char* decodeSharedFile(const BatchFile& file, const Codebook* codebook, uint64_t& bytesOut) {
+    MappedFile input;
+    if (!passedEverywhere(input.open(file.input)))
+        return "Unable to open input file";
+    ContainerHeader header;
+    DecodeTables built;
+    if (!passedEverywhere(parseHeader(input.data(), input.size(), header)))
+        return "Invalid encoded file";
+    if (codebook && !codedWith(header, *codebook))
+        return "Encoded file was not coded with the codebook";
+    if (!codebook && !passedEverywhere(buildDecodeTables(header, built)))
+        return "Invalid encoded file";
+    const DecodeTables& tables = codebook ? codebook->tables : built;
+
+    uint64_t firstBlock, lastBlock;
+    blockRange(header.blockCount(), firstBlock, lastBlock);
+    uint64_t begin = firstBlock < lastBlock ? header.blockBegin(firstBlock) : 0;
+    std::vector<unsigned char> out(firstBlock < lastBlock ? header.blockEnd(lastBlock - 1) - begin : 0);
+    const unsigned char* encoded = input.data() + header.dataOffset();
+    bool valid = true;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) reduction(&& : valid)
+#endif
+    for (int64_t b = firstBlock; b < static_cast<int64_t>(lastBlock); ++b)
+        valid = decodeBlocks(header, tables, encoded, header.dataSize(), 0, b, b + 1,
+                             out.data() + (header.blockBegin(b) - begin)) && valid;
+    if (!passedEverywhere(valid))
+        return "Invalid encoded file";
+
+    MPI_File output;
+    bool opened = openForWriteAll(file.output.c_str(), MPI_COMM_WORLD, output);
+    if (opened) {
+        writeAtAll(output, begin, out.data(), out.size(), MPI_COMM_WORLD);
+        opened = MPI_File_close(&output) == MPI_SUCCESS;
+    }
+    if (!passedEverywhere(opened))
+        return "Unable to write output file";
+    bytesOut += header.inputSize;
+    return nullptr;
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    Options options;
+    uint64_t tableCount, maxLength, streams;
+    bool parsed = options.parse(argc, argv, {"decode", "list", "codebook", "tables", "max-code-length", "interleave"});
+    if (!parsed || options.arguments().size() < (options.has("list") ? 1u : 2u) ||
+        !options.number("tables", 1, tableCount) || tableCount < 1 || tableCount > MAX_CODE_TABLES ||
+        !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS ||
+        (options.has("codebook") && tableCount > 1)) {
+        if (my_rank == 0) {
+            cerr << "Usage: " << argv[0] << " [--tables=N | --codebook=FILE] [--max-code-length=L] [--interleave=S]"
+                 << " [--list=LIST] <output_dir> <input> ..." << endl;
+            cerr << "       " << argv[0] << " --decode [--codebook=FILE] [--list=LIST] <output_dir> <encoded_file> ..."
+                 << endl;
+            cerr << "       inputs are files or directories of files, LIST a file naming one input per line" << endl;
+            cerr << "       N, L, S and FILE as for encode_openmp" << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    double startTime = MPI_Wtime();
+
+    bool decode = options.has("decode");
+    bool shared = options.has("codebook");
+    const vector<string>& arguments = options.arguments();
+    string outputDirectory = arguments[0];
+
+    // Process 0 collects the files, largest first
+    vector<BatchFile> files;
+    bool made = true;
+    if (my_rank == 0) {
+        vector<string> paths;
+        if (!isDirectory(outputDirectory)) {
+            cerr << "Error: Output directory does not exist: " << outputDirectory << endl;
+            made = false;
+        }
+        for (size_t i = 1; made && i < arguments.size(); ++i) {
+            if (!addBatchPath(arguments[i], paths)) {
+                cerr << "Error: Unable to open input file: " << arguments[i] << endl;
+                made = false;
+            }
+        }
+        if (made && options.has("list") && !addBatchList(options.value("list"), paths)) {
+            cerr << "Error: Unable to read file list: " << options.value("list") << endl;
+            made = false;
+        }
+        string duplicate;
+        if (made)
+            duplicate = makeBatch(paths, decode, outputDirectory, files);
+        if (!duplicate.empty()) {
+            cerr << "Error: Another input has the same output file as: " << duplicate << endl;
+            made = false;
+        }
+    }
+    if (!broadcastBatch(files, made, my_rank)) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Every process reads the codebook
+    Codebook codebook;
+    int loaded = !shared || readCodebook(options.value("codebook"), codebook);
+    MPI_Allreduce(MPI_IN_PLACE, &loaded, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (!loaded) {
+        if (my_rank == 0)
+            cerr << "Error: Invalid codebook file: " << options.value("codebook") << endl;
+        MPI_Finalize();
+        return 1;
+    }
+
+    CodecOptions codecOptions;
+    codecOptions.tables = static_cast<unsigned>(tableCount);
+    codecOptions.maxCodeLength = static_cast<unsigned>(maxLength);
+    codecOptions.streams = static_cast<unsigned>(streams);
+    Codec codec(codecOptions);
+    if (shared)
+        codec.setCodebook(codebook);
+    vector<unsigned char> out;
+
+    // totals: files done, files failed, bytes in, bytes out
+    uint64_t totals[4] = {0, 0, 0, 0};
+    int64_t count = static_cast<int64_t>(files.size());
+
+    // The files larger than an even share of the batch and longer than a
+    // block are coded by every process together. Being the largest, they
+    // come first; process 0 counts them.
+    int64_t sharedCount = 0;
+    uint64_t batchSize = 0;
+    for (const BatchFile& file : files)
+        batchSize += file.size;
+    while (num_procs > 1 && sharedCount < count && files[sharedCount].size > codecOptions.blockSize &&
+           files[sharedCount].size * num_procs > batchSize)
+        sharedCount++;
+    for (int64_t i = 0; i < sharedCount; ++i) {
+        uint64_t bytesOut = 0;
+        const char* error = decode ? decodeSharedFile(files[i], shared ? &codebook : nullptr, bytesOut)
+                                   : encodeSharedFile(files[i], codecOptions, shared ? &codebook : nullptr, bytesOut);
+        if (my_rank != 0)
+            continue;
+        if (error) {
+            cerr << "Error: " << error << ": " << files[i].input << endl;
+        } else {
+            totals[2] += files[i].size;
+            totals[3] += bytesOut;
+        }
+        totals[error ? 1 : 0]++;
+    }
+
+    // Every process, process 0 included, takes the rest one at a time from
+    // a counter that process 0 holds
+    int64_t* next;
+    MPI_Win window;
+    MPI_Win_allocate(my_rank == 0 ? sizeof(int64_t) : 0, sizeof(int64_t), MPI_INFO_NULL, MPI_COMM_WORLD, &next,
+                     &window);
+    if (my_rank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+        *next = sharedCount;
+        MPI_Win_unlock(0, window);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (;;) {
+        const int64_t one = 1;
+        int64_t i;
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+        MPI_Fetch_and_op(&one, &i, MPI_INT64_T, 0, 0, MPI_SUM, window);
+        MPI_Win_unlock(0, window);
+        if (i >= count)
+            break;
+        const char* error =
+            processBatchFile(codec, shared ? &codebook : nullptr, files[i], decode, out, totals[2], totals[3]);
+        if (error)
+            cerr << "Error: " << error << ": " << files[i].input << endl;
+        totals[error ? 1 : 0]++;
+    }
+    MPI_Win_free(&window);
+
+    uint64_t sums[4];
+    MPI_Reduce(totals, sums, 4, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    double elapsedTime = MPI_Wtime() - startTime;
+    MPI_Finalize();
+
+    if (my_rank == 0) {
+        cout << (decode ? "Decoded " : "Encoded ") << sums[0] << " of " << count << " files, " << sums[2]
+             << " bytes to " << sums[3] << " bytes" << endl;
+        cout << "Time taken: " << elapsedTime << " seconds" << endl;
+    }
+    return my_rank == 0 && sums[1] ? 1 : 0;
+}
@@ -1,94 +1,52 @@
 #include <iostream>
 #include <fstream>
 #include <map>
-#include <bitset>
 #include <mpi.h>
 #include <ctime>
 #include <vector>
 
-using namespace std;
-
-// Node for Huffman Tree
-struct Node {
-    char data;
-    Node* left;
-    Node* right;
-
-    Node(char data) {
-        this->data = data;
-        left = right = nullptr;
-    }
-};
-
-// Deserialize Huffman Tree from serialized string
-Node* deserializeHuffmanTree(string& serializedTree, size_t& index) {
-    if (index >= serializedTree.size())
-        return nullptr;
+#include "../common/codebook.h"
+#include "../common/container.h"
+#include "../common/mapped_file.h"
+#include "../common/mpi_io.h"
+#include "../common/mpi_stats.h"
+#include "../common/options.h"
 
-    if (serializedTree[index] == '0') {
-        index++;
-        return nullptr;
-    }
+using namespace std;
 
-    index++;
-    Node* root = new Node(serializedTree[index]);
-    index++;
-    root->left = deserializeHuffmanTree(serializedTree, index);
-    root->right = deserializeHuffmanTree(serializedTree, index);
-    return root;
+// Decode text using the Huffman decode tables. data holds size encoded bytes
+// from data byte dataBegin on. Returns false on an invalid code.
+bool decodeText(const unsigned char* data, size_t size, uint64_t dataBegin, const ContainerHeader& header,
+                const DecodeTables& tables, uint64_t firstBlock, uint64_t lastBlock, string& decodedText) {
+    if (firstBlock >= lastBlock)
+        return true;
+    decodedText.assign(header.blockEnd(lastBlock - 1) - header.blockBegin(firstBlock), '\0');
+    return decodeBlocks(header, tables, data, size, dataBegin, firstBlock, lastBlock,
+                        reinterpret_cast<unsigned char*>(&decodedText[0]));
 }
 
-// Decode text using Huffman Tree and Huffman codes
-string decodeText(string binaryString, Node* root) {
-    string decodedText = "";
-    Node* current = root;
-    for (char bit : binaryString) {
-        if (bit == '0') {
-            current = current->left;
-        } else {
-            current = current->right;
-        }
-
-        if (current->left == nullptr && current->right == nullptr) {
-            if (current->data != '~')
-                decodedText += current->data;
-            else
-                decodedText += '\n';
-            current = root;
-        }
-    }
-    return decodedText;
+// Read the bytes holding the bits of blocks [firstBlock, lastBlock) into
+// buffer; start is the data byte they begin at
+bool readBinaryData(ifstream& encodedFile, const ContainerHeader& header, uint64_t firstBlock, uint64_t lastBlock,
+                    vector<unsigned char>& buffer, uint64_t& start) {
+    if (firstBlock >= lastBlock)
+        return true;
+    start = header.blockBitBegin(firstBlock) / 8;
+    uint64_t end = (header.blockBitEnd(lastBlock - 1) + 7) / 8;
+    encodedFile.seekg(header.dataOffset() + start); // Move file pointer to start position
+    buffer.resize(end - start);
+    return !encodedFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size()).fail();
 }
 
-string decodeBinaryData(ifstream& encodedFile, Node* root, size_t start, size_t end) {
-    string binaryString;
-    encodedFile.seekg(start); // Move file pointer to start position
-    size_t fileSize = end - start;
-
-    // Read binary data from file
-    char* buffer = new char[fileSize];
-    encodedFile.read(buffer, fileSize);
-    encodedFile.close();
-
-    // Convert binary data to binary string
-    for (size_t i = 0; i < fileSize; ++i) {
-        bitset<8> bits(buffer[i]); // Convert each byte to binary
-        binaryString += bits.to_string();
-    }
-
-    delete[] buffer;
-
-    // Find the position of the last non-zero bit
-    size_t lastNonZeroPos = binaryString.find_last_not_of('0');
-    if (lastNonZeroPos != string::npos) {
-        binaryString.resize(lastNonZeroPos + 1); // Remove trailing zeros
-    } else {
-        binaryString.clear(); // Handle case where the string is all zeros
-    }
-
-    // Decode binary string using Huffman Tree
-    string decodedText = decodeText(binaryString, root);
-    return decodedText;
+// Whether passed holds on every process. Every process must call this, so
+// that a failure on any of them stops them all together; process 0 reports
+// it.
+bool passedEverywhere(bool passed, const string& error, int rank) {
+    int all = passed;
+    MPI_Allreduce(MPI_IN_PLACE, &all, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (!all && rank == 0)
+        cerr << "Error: " << error << endl;
+    return all;
 }
 
 int main(int argc, char* argv[]) {
@@ -98,82 +56,114 @@ int main(int argc, char* argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 4) {
-        cerr << "Usage: " << argv[0] << " <encoded_file> <tree_file> <output_file>" << endl;
+    Options options;
+    Stats stats;
+    if (!options.parse(argc, argv, {"mmap", "stats", "codebook"}) || options.arguments().size() != 2 ||
+        (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+        if (rank == 0) {
+            cerr << "Usage: " << argv[0] << " [--mmap] [--codebook=FILE] [--stats=json] <encoded_file> <output_file>"
+                 << endl;
+            cerr << "       FILE the codebook the file was encoded with" << endl;
+            cerr << "       --stats=json reports phase times and counters over all processes on stderr" << endl;
+        }
+        MPI_Finalize();
         return 1;
     }
 
     double startTime = MPI_Wtime();
 
-    string encodedFileName = argv[1];
-    string treeFileName = argv[2];
-    string outputFileName = argv[3];
+    bool mapped = options.has("mmap");
+    bool shared = options.has("codebook");
+    string encodedFileName = options.arguments()[0];
+    string outputFileName = options.arguments()[1];
 
-    // Read serialized Huffman tree
-    ifstream treeFile(treeFileName);
-    if (!treeFile) {
-        cerr << "Error: Unable to open Huffman tree file: " << treeFileName << endl;
+    // The decode table of a codebook serves every file coded with it
+    Codebook codebook;
+    bool loaded = !shared || readCodebook(options.value("codebook"), codebook);
+    if (!passedEverywhere(loaded, "Invalid codebook file: " + options.value("codebook"), rank)) {
+        MPI_Finalize();
         return 1;
     }
-    string serializedTree;
-    getline(treeFile, serializedTree);
-    treeFile.close();
-
-    // Deserialize Huffman tree
-    size_t index = 0;
-    Node* root = deserializeHuffmanTree(serializedTree, index);
-
-    // Read encoded text from file
-    ifstream encodedFile(encodedFileName, ios::binary); // Open encoded file in binary mode
-    if (!encodedFile) {
-        cerr << "Error: Unable to open encoded file: " << encodedFileName << endl;
+
+    // Read the container header and rebuild the decode tables. With --mmap
+    // every process maps the file and decodes its blocks in place.
+    ifstream encodedFile;
+    MappedFile mappedFile;
+    bool opened;
+    if (mapped) {
+        opened = mappedFile.open(encodedFileName);
+    } else {
+        encodedFile.open(encodedFileName, ios::binary); // Open encoded file in binary mode
+        opened = encodedFile.is_open();
+    }
+    if (!passedEverywhere(opened, "Unable to open encoded file: " + encodedFileName, rank)) {
+        MPI_Finalize();
         return 1;
     }
-
-    // Calculate chunk size for each process
-    encodedFile.seekg(0, ios::end);
-    size_t fileSize = encodedFile.tellg();
-    size_t chunkSize = fileSize / size;
-    size_t start = rank * chunkSize;
-    size_t end = (rank == size - 1) ? fileSize : (rank + 1) * chunkSize;
-
-    // Decode binary data using Huffman Tree
-    string decodedText = decodeBinaryData(encodedFile, root, start, end);
-    
-     int decodedsize = decodedText.size();
-     
-    // Gather the sizes of decoded text from all processes
-    vector<int> recvCounts(size);
-    
-    MPI_Gather(&decodedsize, 1, MPI_INT, recvCounts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // Calculate the displacement for the gathered data
-    vector<int> displs(size, 0);
-    for (int i = 1; i < size; i++) {
-        displs[i] = displs[i - 1] + recvCounts[i - 1];
+    ContainerHeader header;
+    DecodeTables builtTables;
+    bool valid = mapped ? parseHeader(mappedFile.data(), mappedFile.size(), header)
+                        : readHeader(encodedFile, header);
+    valid = valid && (shared || buildDecodeTables(header, builtTables));
+    if (!passedEverywhere(valid, "Invalid encoded file: " + encodedFileName, rank) ||
+        !passedEverywhere(!shared || codedWith(header, codebook),
+                          "Encoded file was not coded with the codebook: " + encodedFileName, rank)) {
+        MPI_Finalize();
+        return 1;
+    }
+    const DecodeTables& tables = shared ? codebook.tables : builtTables;
+    stats.lap("parse");
+
+    // Assign a contiguous range of blocks to each process
+    uint64_t blockCount = header.blockCount();
+    uint64_t firstBlock = blockCount * rank / size;
+    uint64_t lastBlock = blockCount * (rank + 1) / size;
+
+    // Read this process's blocks, unless they are decoded in place
+    vector<unsigned char> buffer;
+    uint64_t start = 0;
+    if (!mapped) {
+        bool read = readBinaryData(encodedFile, header, firstBlock, lastBlock, buffer, start);
+        encodedFile.close();
+        if (!passedEverywhere(read, "Unable to read encoded file: " + encodedFileName, rank)) {
+            MPI_Finalize();
+            return 1;
+        }
+        stats.lap("read");
     }
 
-    // Gather decoded text from all processes to process 0
-    string totalDecodedText;
-    if (rank == 0) {
-        totalDecodedText.resize(displs[size - 1] + recvCounts[size - 1]);
+    // Decode this process's blocks
+    string decodedText;
+    bool decoded = mapped ? decodeText(mappedFile.data() + header.dataOffset(), header.dataSize(), 0, header,
+                                       tables, firstBlock, lastBlock, decodedText)
+                          : decodeText(buffer.data(), buffer.size(), start, header, tables, firstBlock, lastBlock,
+                                       decodedText);
+    if (!passedEverywhere(decoded, "Invalid Huffman code", rank)) {
+        MPI_Finalize();
+        return 1;
     }
+    stats.lap("decode");
 
-    MPI_Gatherv(decodedText.data(), decodedText.size(), MPI_CHAR, &totalDecodedText[0], recvCounts.data(), displs.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
+    // Each process writes its decoded text after that of the processes before it
+    uint64_t decodedSize = decodedText.size();
+    uint64_t outputOffset = 0;
+    MPI_Exscan(&decodedSize, &outputOffset, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0)
+        outputOffset = 0; // MPI_Exscan leaves rank 0's result undefined
 
     // Write decoded text to output file
-    if (rank == 0) {
-        ofstream outputFile(outputFileName);
-        if (!outputFile) {
+    MPI_File outputFile;
+    if (!openForWriteAll(outputFileName.c_str(), MPI_COMM_WORLD, outputFile)) {
+        if (rank == 0)
             cerr << "Error: Unable to open output file: " << outputFileName << endl;
-            return 1;
-        }
-        outputFile << totalDecodedText;
-        outputFile.close();
-
-        // Release memory
-        delete root;
+        MPI_Finalize();
+        return 1;
+    }
+    writeAtAll(outputFile, outputOffset, decodedText.data(), decodedSize, MPI_COMM_WORLD);
+    MPI_File_close(&outputFile);
+    stats.lap("write");
 
+    if (rank == 0) {
         double endTime = MPI_Wtime();
         double elapsedTime = endTime - startTime;
 
@@ -181,6 +171,15 @@ int main(int argc, char* argv[]) {
         cout << "Time taken: " << elapsedTime << " seconds" << endl;
     }
 
+    // Counters are per process: the encoded bytes of its blocks and the
+    // text they decode to
+    uint64_t encodedSize =
+        firstBlock < lastBlock ? (header.blockBitEnd(lastBlock - 1) + 7) / 8 - header.blockBitBegin(firstBlock) / 8 : 0;
+    stats.addBytes(encodedSize, decodedSize);
+    stats.addCount("blocks", lastBlock - firstBlock);
+    stats.setCodeLengths(header);
+    writeStatsAcrossRanks(stats, "decode_mpi", MPI_COMM_WORLD, cerr);
+
     MPI_Finalize();
 
     return 0;
@@ -2,119 +2,18 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <map>
 #include <string>
-#include <queue>
-#include <bitset>
+
+#include "../common/codebook.h"
+#include "../common/encode.h"
+#include "../common/mapped_file.h"
+#include "../common/mpi_container.h"
+#include "../common/mpi_stats.h"
+#include "../common/multi_table.h"
+#include "../common/options.h"
 
 //version=1.1.3
 using namespace std;
-// Node for Huffman Tree
-struct Node {
-    char data;
-    int frequency;
-    Node* left;
-    Node* right;
-
-    Node(char data, int frequency) {
-        this->data = data;
-        this->frequency = frequency;
-        left = right = nullptr;
-    }
-};
-
-// Comparison function for priority queue
-struct compare {
-    bool operator()(Node* left, Node* right) {
-        return left->frequency > right->frequency;
-    }
-};
-
-// Build Huffman Tree
-Node* buildHuffmanTree(std::map<char, int>& frequencies) {
-    std::priority_queue<Node*, std::vector<Node*>, compare> pq;
-
-    // Populate priority queue with leaf nodes
-    for (const auto& entry : frequencies) {
-        auto node = new Node(entry.first, entry.second);
-        pq.push(node);
-    }
-
-    // Combine nodes until there is only one root node left
-    while (pq.size() > 1) {
-        Node* left = pq.top();
-        pq.pop();
-        Node* right = pq.top();
-        pq.pop();
-
-        // Create a new node with combined frequency
-        Node* combined = new Node('\0', left->frequency + right->frequency);
-        combined->left = left;
-        combined->right = right;
-
-        // Push the combined node back to the priority queue
-        pq.push(combined);
-    }
-
-    // Return the root of the Huffman tree
-    return pq.top();
-}
-
-// Serialize Huffman Tree and write to file
-void serializeHuffmanTree(Node* root, std::ofstream& outputFile) {
-    if (root == nullptr) {
-        outputFile << "0"; // Represent null node
-        return;
-    }
-
-    outputFile << "1" << root->data;
-    serializeHuffmanTree(root->left, outputFile);
-    serializeHuffmanTree(root->right, outputFile);
-}
-
-// Traverse the Huffman Tree and assign codes to each character
-void assignHuffmanCodes(Node* root, std::string code, std::map<char, std::string>& codes) {
-    if (root == nullptr)
-        return;
-
-    if (root->data != '\0') {
-        codes[root->data] = code;
-    }
-
-    assignHuffmanCodes(root->left, code + "0", codes);
-    assignHuffmanCodes(root->right, code + "1", codes);
-}
-
-void encodeText(const string& text, const map<char, string>& codes, ofstream& outputFile) {
-    // Encode text using Huffman codes
-    string encodedText;
-    for (char c : text) {
-        if (c != '\n')
-            encodedText += codes.at(c);
-        else
-            encodedText += codes.at('~');
-    }
-
-    // Convert encoded text to bytes
-    vector<unsigned char> bytes;
-    int bitsRemaining = 0;
-    unsigned char currentByte = 0;
-    for (char bit : encodedText) {
-        currentByte |= (bit - '0') << (7 - bitsRemaining);
-        bitsRemaining++;
-        if (bitsRemaining == 8) {
-            bytes.push_back(currentByte);
-            currentByte = 0;
-            bitsRemaining = 0;
-        }
-    }
-    if (bitsRemaining != 0) {
-        bytes.push_back(currentByte);
-    }
-
-    // Write bytes to output file
-    outputFile.write(reinterpret_cast<const char*>(&bytes[0]), bytes.size());
-}
 
 int main(int argc, char* argv[]) {
     MPI_Init(&argc, &argv);
@@ -123,124 +22,153 @@ int main(int argc, char* argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
 
-    if (argc != 4) {
-        if (my_rank == 0)
-            std::cerr << "Usage: " << argv[0] << " <input_file> <huffman_tree_file> <encoded_text_file>" << std::endl;
+    Options options;
+    uint64_t tableCount, maxLength, streams;
+    Stats stats;
+    if (!options.parse(argc, argv, {"mmap", "tables", "max-code-length", "interleave", "stats", "codebook"}) ||
+        options.arguments().size() != 2 || !options.number("tables", 1, tableCount) || tableCount < 1 ||
+        tableCount > MAX_CODE_TABLES || !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS ||
+        (options.has("codebook") && tableCount > 1) ||
+        (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+        if (my_rank == 0) {
+            std::cerr << "Usage: " << argv[0] << " [--mmap] [--tables=N | --codebook=FILE] [--max-code-length=L]"
+                      << " [--interleave=S] [--stats=json] <input_file> <output_file>" << std::endl;
+            std::cerr << "       N code tables, 1 to " << MAX_CODE_TABLES << ", chosen per block" << std::endl;
+            std::cerr << "       codes of at most L bits, " << MIN_CODE_LENGTH_LIMIT << " to "
+                      << MAX_CODE_LENGTH_LIMIT << std::endl;
+            std::cerr << "       S streams per block, 1 to " << MAX_STREAMS << ", decoded side by side" << std::endl;
+            std::cerr << "       FILE a codebook from train_codebook, used instead of counting the input"
+                      << std::endl;
+            std::cerr << "       --stats=json reports phase times and counters over all processes on stderr"
+                      << std::endl;
+        }
         MPI_Finalize();
         return 1;
     }
 
-    std::string inputFileName = argv[1];
-    std::string huffmanTreeFileName = argv[2];
-    std::string encodedTextFileName = argv[3];
-    std::ifstream inputFile;
-    int file_size;
-
-    if (my_rank == 0) {
-        inputFile.open(inputFileName);
-        if (!inputFile) {
-            std::cerr << "Error: Unable to open input file: " << inputFileName << std::endl;
-            MPI_Finalize();
-            return 1;
-        }
-    }
-
-    // Read the entire file on process 0
-    std::string text;
-    if (my_rank == 0) {
-        text = std::string((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
-        inputFile.close();
-    }
-
-    // Broadcast the size of the text to all processes
-    int text_size = text.size();
-    MPI_Bcast(&text_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // Calculate the size of data for each process
-    int chunk_size = text_size / num_procs;
-    int remainder = text_size % num_procs;
-    int my_chunk_size = (my_rank < remainder) ? chunk_size + 1 : chunk_size;
-
-    // Allocate memory for receiving chunk
-    char *my_chunk = new char[my_chunk_size + 1];
+    bool mapped = options.has("mmap");
+    bool shared = options.has("codebook");
+    std::string inputFileName = options.arguments()[0];
+    std::string encodedTextFileName = options.arguments()[1];
 
-    // Scatter the text to all processes
-    int *recvcounts = new int[num_procs];
-    int *displs = new int[num_procs];
-    for (int i = 0; i < num_procs; ++i) {
-        recvcounts[i] = (i < remainder) ? chunk_size + 1 : chunk_size;
-        displs[i] = (i == 0) ? 0 : (displs[i - 1] + recvcounts[i - 1]);
-    }
-    MPI_Scatterv(text.c_str(), recvcounts, displs, MPI_CHAR, my_chunk, my_chunk_size, MPI_CHAR, 0, MPI_COMM_WORLD);
-
-    // Add null terminator after receiving the chunk
-    my_chunk[my_chunk_size] = '\0';
-
-    // Collect frequency of characters from each process
-    std::map<char, int> local_frequencies;
-    for (int i = 0; i < my_chunk_size; ++i) {
-        char c = my_chunk[i];
-            if (c != '\n')
-                local_frequencies[c]++;
-            else
-                local_frequencies['~']++;
-    }
-
-    // Combine frequencies from all processes
-    std::vector<int> local_frequencies_vec(256, 0);
-    for (const auto& pair : local_frequencies) {
-        char c = pair.first;
-        int count = pair.second;
-        local_frequencies_vec[c] = count;
+    // Every process reads the codebook
+    Codebook codebook;
+    int loaded = !shared || readCodebook(options.value("codebook"), codebook);
+    MPI_Allreduce(MPI_IN_PLACE, &loaded, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (!loaded) {
+        if (my_rank == 0)
+            std::cerr << "Error: Invalid codebook file: " << options.value("codebook") << std::endl;
+        MPI_Finalize();
+        return 1;
     }
 
-    std::vector<int> global_frequencies(256, 0);
-    MPI_Reduce(local_frequencies_vec.data(), global_frequencies.data(), 256, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
-
-    // Build Huffman Tree
-    if (my_rank == 0) {
-        std::map<char, int> frequencies;
-        for (int i = 0; i < 256; ++i) {
-            if (global_frequencies[i] > 0) {
-                frequencies[static_cast<char>(i)] = global_frequencies[i];
-            }
-        }
-        Node* root = buildHuffmanTree(frequencies);
-
-        // Serialize Huffman tree and write to file
-        std::ofstream treeFile(huffmanTreeFileName);
-        if (!treeFile) {
-            std::cerr << "Error: Unable to open Huffman tree file." << std::endl;
-            MPI_Finalize();
-            return 1;
-        }
-        serializeHuffmanTree(root, treeFile);
-        treeFile.close();
-
-        // Assign Huffman codes to characters
-        std::map<char, std::string> codes;
-        assignHuffmanCodes(root, "", codes);
-
-        // Encode text using Huffman codes and write to output file
-        std::ofstream outputFile(encodedTextFileName);
-        if (!outputFile) {
-            std::cerr << "Error: Unable to open output file." << std::endl;
-            MPI_Finalize();
-            return 1;
-        }
-        encodeText(text, codes, outputFile);
-        outputFile.close();
-
-        delete root;
+    // Every process opens the input and reads its own share of it, or maps
+    // the whole file from a shared filesystem and uses its share in place
+    MPI_File inputFile;
+    MappedFile mappedInput;
+    int opened;
+    if (mapped)
+        opened = mappedInput.open(inputFileName);
+    else
+        opened = MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(inputFileName.c_str()), MPI_MODE_RDONLY,
+                               MPI_INFO_NULL, &inputFile) == MPI_SUCCESS;
+    MPI_Allreduce(MPI_IN_PLACE, &opened, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (!opened) {
+        if (my_rank == 0)
+            std::cerr << "Error: Unable to open input file: " << inputFileName << std::endl;
+        MPI_Finalize();
+        return 1;
     }
-
-    // Cleanup
-    delete[] my_chunk;
+    MPI_Offset file_size = mappedInput.size();
+    if (!mapped)
+        MPI_File_get_size(inputFile, &file_size);
+
+    ContainerHeader header;
+    header.inputSize = file_size;
+    header.setStreams(streams);
+    header.blockOffsets.assign(header.indexSize(), 0);
+
+    // Assign a contiguous range of blocks to each process
+    uint64_t blockCount = header.blockCount();
+    uint64_t firstBlock = blockCount * my_rank / num_procs;
+    uint64_t lastBlock = blockCount * (my_rank + 1) / num_procs;
+
+    // Read the input bytes of this process's blocks
+    uint64_t chunkBegin = firstBlock < lastBlock ? header.blockBegin(firstBlock) : 0;
+    uint64_t chunkEnd = firstBlock < lastBlock ? header.blockEnd(lastBlock - 1) : 0;
+    std::vector<char> my_chunk;
+    const char* chunk = reinterpret_cast<const char*>(mappedInput.data()) + chunkBegin;
+    if (!mapped) {
+        my_chunk.resize(chunkEnd - chunkBegin);
+        readAtAll(inputFile, chunkBegin, my_chunk.data(), my_chunk.size(), MPI_COMM_WORLD);
+        MPI_File_close(&inputFile);
+        chunk = my_chunk.data();
+    }
+    stats.lap("read");
+    stats.addCount("bytes_in", chunkEnd - chunkBegin);
+
+    // Collect frequency of characters from each process. The block
+    // histograms also give the blocks their offsets, so they are counted
+    // even with a codebook.
+    std::vector<Histogram> histograms =
+        countBlockHistograms(reinterpret_cast<const unsigned char*>(chunk), chunkEnd - chunkBegin, header.blockSize);
+    stats.lap("histogram");
+
+    // Combine frequencies from all processes; every process builds the same
+    // codes, or takes them from the codebook without exchanging anything.
+    // Canonical codes only depend on the code lengths, one for every byte
+    // value. With more than one table, every block is coded with whichever
+    // table built from the block histograms of all processes suits it best.
+    Histogram global_frequencies;
+    std::vector<CodeTable> codeTables(1);
+    if (shared) {
+        useCodebook(codebook, header);
+        codeTables[0] = codebook.codes;
+    } else {
+        Histogram local_frequencies = totalHistogram(histograms);
+        MPI_Allreduce(local_frequencies.data(), global_frequencies.data(), 256, MPI_UINT64_T, MPI_SUM,
+                      MPI_COMM_WORLD);
+        stats.lap("exchange");
+        header.lengths = huffmanCodeLengths(global_frequencies, maxLength);
+        stats.lap("tree");
+        canonicalCodes(header.lengths, codeTables[0]);
+    }
+    stats.lap("codes");
+    if (tableCount > 1) {
+        auto sumOverProcesses = [](Histogram* sums, unsigned count) {
+            MPI_Allreduce(MPI_IN_PLACE, sums->data(), 256 * count, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        };
+        chooseCodeTables(histograms, firstBlock, global_frequencies, tableCount, maxLength, sumOverProcesses,
+                         header, codeTables);
+        stats.lap("tables");
+    }
+
+    // Encode this process's blocks and write them to the output file
+    uint64_t bitBegin, bitEnd;
+    std::vector<unsigned char> data;
+    unsigned char tail;
+    encodeRankRange(reinterpret_cast<const unsigned char*>(chunk), codeTables, histograms, header, firstBlock,
+                    bitBegin, bitEnd, data, tail, MPI_COMM_WORLD);
+    stats.lap("encode");
+    bool written = writeContainerShare(encodedTextFileName, header, firstBlock, lastBlock, bitBegin, bitEnd, data,
+                                       tail, MPI_COMM_WORLD);
+    stats.lap("write");
+    stats.addCount("bytes_out", data.size());
+    if (!written && my_rank == 0)
+        std::cerr << "Error: Unable to open output file." << std::endl;
+
+    // Counters are per process: its share of the input and of the output
+    stats.addCount("blocks", lastBlock - firstBlock);
+    stats.setCodeLengths(header);
+    writeStatsAcrossRanks(stats, "encode_mpi", MPI_COMM_WORLD, cerr);
 
     MPI_Finalize();
+    if (!written)
+        return 1;
     if (my_rank == 0) {
         cout << "Compression completed successfully." << endl;
     }
     return 0;
 }
-
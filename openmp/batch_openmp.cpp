@@ -0,0 +1,133 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "../common/batch.h"
+#include "../common/codebook.h"
+#include "../common/options.h"
+
+using namespace std;
+
+// Encode or decode a batch of files in one process. Files holding at least
+// a block per thread go first, one at a time, with their blocks spread
+// over all threads. Every other file is an OpenMP task of its own, taken
+// largest first by whichever thread is free, so threads stay busy however
+// much the file sizes differ. Every thread keeps one Codec for the whole
+// batch.
+
+// What one thread keeps between the files it works on
+struct BatchWorker {
+    explicit BatchWorker(const CodecOptions& options) : codec(options), bytesIn(0), bytesOut(0), failed(0) {}
+
+    Codec codec;
+    vector<unsigned char> out;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t failed;
+};
+
+void processFile(BatchWorker& worker, const Codebook* codebook, const BatchFile& file, bool decode) {
+    const char* error =
+        processBatchFile(worker.codec, codebook, file, decode, worker.out, worker.bytesIn, worker.bytesOut);
+    if (error) {
+        #pragma omp critical
+        cerr << "Error: " << error << ": " << file.input << endl;
+        worker.failed++;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    uint64_t tableCount, maxLength, streams;
+    bool parsed = options.parse(argc, argv, {"decode", "list", "codebook", "tables", "max-code-length", "interleave"});
+    if (!parsed || options.arguments().size() < (options.has("list") ? 1u : 2u) ||
+        !options.number("tables", 1, tableCount) || tableCount < 1 || tableCount > MAX_CODE_TABLES ||
+        !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS ||
+        (options.has("codebook") && tableCount > 1)) {
+        cerr << "Usage: " << argv[0] << " [--tables=N | --codebook=FILE] [--max-code-length=L] [--interleave=S]"
+             << " [--list=LIST] <output_dir> <input> ..." << endl;
+        cerr << "       " << argv[0] << " --decode [--codebook=FILE] [--list=LIST] <output_dir> <encoded_file> ..."
+             << endl;
+        cerr << "       inputs are files or directories of files, LIST a file naming one input per line" << endl;
+        cerr << "       N, L, S and FILE as for encode_openmp" << endl;
+        return 1;
+    }
+
+    double startTime = omp_get_wtime();
+
+    bool decode = options.has("decode");
+    bool shared = options.has("codebook");
+    const vector<string>& arguments = options.arguments();
+    string outputDirectory = arguments[0];
+    if (!isDirectory(outputDirectory)) {
+        cerr << "Error: Output directory does not exist: " << outputDirectory << endl;
+        return 1;
+    }
+
+    // Collect the files, largest first
+    vector<string> paths;
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        if (!addBatchPath(arguments[i], paths)) {
+            cerr << "Error: Unable to open input file: " << arguments[i] << endl;
+            return 1;
+        }
+    }
+    if (options.has("list") && !addBatchList(options.value("list"), paths)) {
+        cerr << "Error: Unable to read file list: " << options.value("list") << endl;
+        return 1;
+    }
+    vector<BatchFile> files;
+    string duplicate = makeBatch(paths, decode, outputDirectory, files);
+    if (!duplicate.empty()) {
+        cerr << "Error: Another input has the same output file as: " << duplicate << endl;
+        return 1;
+    }
+
+    CodecOptions codecOptions;
+    codecOptions.tables = static_cast<unsigned>(tableCount);
+    codecOptions.maxCodeLength = static_cast<unsigned>(maxLength);
+    codecOptions.streams = static_cast<unsigned>(streams);
+    Codebook codebook;
+    if (shared && !readCodebook(options.value("codebook"), codebook)) {
+        cerr << "Error: Invalid codebook file: " << options.value("codebook") << endl;
+        return 1;
+    }
+    int threads = omp_get_max_threads();
+    vector<BatchWorker> workers(threads, BatchWorker(codecOptions));
+    if (shared) {
+        for (BatchWorker& worker : workers)
+            worker.codec.setCodebook(codebook);
+    }
+
+    // Large files, each with all threads
+    uint64_t largeSize = static_cast<uint64_t>(DEFAULT_BLOCK_SIZE) * threads;
+    size_t large = 0;
+    for (; large < files.size() && files[large].size >= largeSize; ++large)
+        processFile(workers[0], shared ? &codebook : nullptr, files[large], decode);
+
+    // The other files, a task each. A task runs on one thread from start
+    // to end, so it can use that thread's worker.
+    #pragma omp parallel
+    #pragma omp single
+    for (size_t i = large; i < files.size(); ++i) {
+        #pragma omp task firstprivate(i)
+        processFile(workers[omp_get_thread_num()], shared ? &codebook : nullptr, files[i], decode);
+    }
+
+    uint64_t bytesIn = 0, bytesOut = 0, failed = 0;
+    for (const BatchWorker& worker : workers) {
+        bytesIn += worker.bytesIn;
+        bytesOut += worker.bytesOut;
+        failed += worker.failed;
+    }
+
+    double elapsedTime = omp_get_wtime() - startTime;
+    cout << (decode ? "Decoded " : "Encoded ") << files.size() - failed << " of " << files.size() << " files, "
+         << bytesIn << " bytes to " << bytesOut << " bytes" << endl;
+    cout << "Time taken: " << elapsedTime << " seconds" << endl;
+
+    return failed ? 1 : 0;
+}
@@ -1,179 +1,234 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <map>
-#include <bitset>
 #include <ctime>
 #include <vector>
 #include <omp.h>
 
-using namespace std;
-
-// Node for Huffman Tree
-struct Node {
-    char data;
-    Node* left;
-    Node* right;
-
-    Node(char data) {
-        this->data = data;
-        left = right = nullptr;
-    }
-};
+#include "../common/codebook.h"
+#include "../common/container.h"
+#include "../common/legacy.h"
+#include "../common/mapped_file.h"
+#include "../common/options.h"
+#include "../common/stats.h"
 
-// Deserialize Huffman Tree from serialized string
-Node* deserializeHuffmanTree(string& serializedTree, size_t& index) {
-    if (index >= serializedTree.size())
-        return nullptr;
+using namespace std;
 
-    if (serializedTree[index] == '0') {
-        index++;
-        return nullptr;
+// Decode text using the Huffman decode tables. Every block starts at a bit
+// offset recorded in the block index and decodes to a known slice of the
+// output, so threads decode whole blocks independently. data holds size
+// encoded bytes from data byte dataBegin on. The time each thread spends
+// decoding goes to the stats. Returns false on an invalid code.
+bool decodeText(const unsigned char* data, size_t size, uint64_t dataBegin, const ContainerHeader& header,
+                const DecodeTables& tables, uint64_t firstBlock, uint64_t lastBlock, string& decodedText,
+                Stats& stats) {
+    decodedText.assign(header.blockEnd(lastBlock - 1) - header.blockBegin(firstBlock), '\0');
+    unsigned char* out = reinterpret_cast<unsigned char*>(&decodedText[0]);
+    bool valid = true;
+    vector<double> threadSeconds(omp_get_max_threads());
+    vector<double>* threadTimes = stats.isEnabled() ? &threadSeconds : nullptr;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&& : valid)
+    for (int64_t b = firstBlock; b < static_cast<int64_t>(lastBlock); ++b) {
+        ScopedTimer timer(threadTimes);
+        valid = decodeBlocks(header, tables, data, size, dataBegin, b, b + 1,
+                             out + (header.blockBegin(b) - header.blockBegin(firstBlock))) && valid;
     }
-
-    index++;
-    Node* root = new Node(serializedTree[index]);
-    index++;
-
-#pragma omp task shared(root, serializedTree, index)
-   root->left = deserializeHuffmanTree(serializedTree, index);
-
-
-#pragma omp task shared(root, serializedTree, index)
-    root->right = deserializeHuffmanTree(serializedTree, index);
-
-#pragma omp taskwait
-    return root;
+    stats.addThreadTimes("decode", threadSeconds);
+    if (!valid)
+        cerr << "Error: Invalid Huffman code" << endl;
+    return valid;
 }
 
-// Decode text using Huffman Tree and Huffman codes
-string decodeText(string binaryString, Node* root) {
-    string decodedText = "";
-    Node* current = root;
-    for (char bit : binaryString) {
-        if (current == nullptr) {
-            cerr << "Error: Invalid Huffman code" << endl;
-            return "";
-        }
-
-        if (bit == '0') {
-            current = current->left;
-        } else {
-            current = current->right;
-        }
-
-        if (current != nullptr && current->left == nullptr && current->right == nullptr) {
-            if (current->data != '~')
-                decodedText += current->data;
-            else
-                decodedText += '\n';
-            current = root;
-        }
+bool decodeBinaryData(ifstream& encodedFile, const ContainerHeader& header, const DecodeTables& tables,
+                      uint64_t firstBlock, uint64_t lastBlock, string& decodedText, Stats& stats) {
+    decodedText.clear();
+    if (firstBlock >= lastBlock)
+        return true;
+
+    // Only read the bytes holding the bits of these blocks
+    uint64_t start = header.blockBitBegin(firstBlock) / 8;
+    uint64_t end = (header.blockBitEnd(lastBlock - 1) + 7) / 8;
+    encodedFile.seekg(header.dataOffset() + start); // Move file pointer to start position
+
+    // Read binary data from file
+    vector<unsigned char> buffer(end - start);
+    if (!encodedFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size())) {
+        cerr << "Error: Unable to read encoded file" << endl;
+        return false;
     }
-    
-    return decodedText;
-}
-
-
-string decodeBinaryData(ifstream &encodedFile, Node *root, size_t start, size_t end) {
-
-  int p = omp_get_max_threads();
-
-  string binaryStrings[p];
-  int i;
-  for (i = 0; i < p; i++) {
-    binaryStrings[i] = "";
-  }
-  string binaryString = "";
+    stats.lap("read");
 
-  encodedFile.seekg(start); // Move file pointer to start position
-  size_t fileSize = end - start;
-
-  // Read binary data from file
-  char *buffer = new char[fileSize];
-  encodedFile.read(buffer, fileSize);
-  encodedFile.close();
-
-// Convert binary data to binary string
-#pragma omp parallel for firstprivate(buffer)
-  for (size_t i = 0; i < fileSize; ++i) {
-    bitset<8> bits(
-        static_cast<unsigned char>(buffer[i])); // Convert each byte to binary
-    binaryStrings[omp_get_thread_num()] += bits.to_string();
-  }
-
-  delete[] buffer;
-
-  for (i = 0; i < p; i++) {
-    binaryString += binaryStrings[i];
-  }
-
-  // Find the position of the last non-zero bit
-  size_t lastNonZeroPos = binaryString.find_last_not_of('0');
-  if (lastNonZeroPos != string::npos) {
-    binaryString.resize(lastNonZeroPos + 1); // Remove trailing zeros
-  } else {
-    binaryString.clear(); // Handle case where the string is all zeros
-  }
-
-  // Decode binary string using Huffman Tree
-  string decodedText = decodeText(binaryString, root);
-  
-  return decodedText;
+    // Decode packed bits using the Huffman decode tables
+    return decodeText(buffer.data(), buffer.size(), start, header, tables, firstBlock, lastBlock, decodedText, stats);
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        cerr << "Usage: " << argv[0] << " <encoded_file> <tree_file> <output_file>" << endl;
-        return 1;
+// Decode a container file, using its block index to split the work, and
+// write the text to the output file. A mapped file is decoded in place.
+// Given a codebook, the file must have been coded with it and is decoded
+// with its decode table.
+bool decodeContainerFile(const string& encodedFileName, bool mapped, const Codebook* codebook,
+                         ofstream& outputFile, Stats& stats) {
+    // Read the container header and rebuild the decode tables
+    ifstream encodedFile;
+    MappedFile mappedFile;
+    bool opened;
+    if (mapped) {
+        opened = mappedFile.open(encodedFileName);
+    } else {
+        encodedFile.open(encodedFileName, ios::binary); // Open encoded file in binary mode
+        opened = encodedFile.is_open();
     }
+    if (!opened) {
+        cerr << "Error: Unable to open encoded file: " << encodedFileName << endl;
+        return false;
+    }
+    ContainerHeader header;
+    DecodeTables builtTables;
+    bool valid = mapped ? parseHeader(mappedFile.data(), mappedFile.size(), header)
+                        : readHeader(encodedFile, header);
+    if (!valid || (!codebook && !buildDecodeTables(header, builtTables))) {
+        cerr << "Error: Invalid encoded file: " << encodedFileName << endl;
+        return false;
+    }
+    if (codebook && !codedWith(header, *codebook)) {
+        cerr << "Error: Encoded file was not coded with the codebook: " << encodedFileName << endl;
+        return false;
+    }
+    const DecodeTables& tables = codebook ? codebook->tables : builtTables;
+    stats.lap("parse");
+
+    // Decode and write a window of blocks at a time, so memory use does not
+    // grow with the file and output starts with the first window. A window
+    // holds enough blocks to keep every thread busy.
+    uint64_t windowBlocks = max<uint64_t>(streamBlockCount(header), 2 * omp_get_max_threads());
+    for (uint64_t first = 0; first < header.blockCount(); first += windowBlocks) {
+        uint64_t last = min(first + windowBlocks, header.blockCount());
+        string decodedText;
+        bool decoded = mapped ? decodeText(mappedFile.data() + header.dataOffset(), header.dataSize(), 0, header,
+                                           tables, first, last, decodedText, stats)
+                              : decodeBinaryData(encodedFile, header, tables, first, last, decodedText, stats);
+        if (!decoded)
+            return false;
+        stats.lap("decode");
+        outputFile.write(decodedText.data(), decodedText.size());
+        stats.lap("write");
+    }
+    stats.addBytes(header.dataOffset() + header.dataSize(), header.inputSize);
+    stats.addCount("blocks", header.blockCount());
+    stats.setCodeLengths(header);
+    return true;
+}
 
-    double startTime = omp_get_wtime();
-
-    string encodedFileName = argv[1];
-    string treeFileName = argv[2];
-    string outputFileName = argv[3];
-
+// Decode a file in the original format, which has no block index, from
+// speculatively decoded chunks resynchronized in order
+bool decodeLegacyFile(const string& encodedFileName, const string& treeFileName, bool mapped,
+                      ofstream& outputFile, Stats& stats) {
     // Read serialized Huffman tree
     ifstream treeFile(treeFileName);
     if (!treeFile) {
         cerr << "Error: Unable to open Huffman tree file: " << treeFileName << endl;
-        return 1;
+        return false;
     }
     string serializedTree;
     getline(treeFile, serializedTree);
     treeFile.close();
 
-    // Deserialize Huffman tree
-    size_t index = 0;
-    Node* root = deserializeHuffmanTree(serializedTree, index);
+    CodeTable codes;
+    DecodeTable table;
+    if (!parseLegacyTree(serializedTree, codes) || !table.build(codes)) {
+        cerr << "Error: Invalid Huffman tree file: " << treeFileName << endl;
+        return false;
+    }
 
-    // Read encoded text from file
-    ifstream encodedFile(encodedFileName, ios::binary); // Open encoded file in binary mode
-    if (!encodedFile) {
+    // Read encoded text from file, or decode it in place from a mapping
+    MappedFile mappedFile;
+    vector<unsigned char> buffer;
+    bool opened;
+    if (mapped) {
+        opened = mappedFile.open(encodedFileName);
+    } else {
+        ifstream encodedFile(encodedFileName, ios::binary);
+        opened = encodedFile.is_open();
+        buffer.assign(istreambuf_iterator<char>(encodedFile), istreambuf_iterator<char>());
+    }
+    if (!opened) {
         cerr << "Error: Unable to open encoded file: " << encodedFileName << endl;
+        return false;
+    }
+    const unsigned char* data = mapped ? mappedFile.data() : buffer.data();
+    size_t size = mapped ? mappedFile.size() : buffer.size();
+    stats.lap("read");
+
+    // Several chunks per thread keep threads busy when some chunks have to
+    // be decoded again
+    uint64_t bitCount = legacyBitCount(data, size);
+    vector<SpeculativeChunk> chunks = decodeSpeculative(table, data, size, 0, bitCount, 4 * omp_get_max_threads());
+    stats.lap("decode");
+
+    uint64_t start = 0, decodedSize = 0;
+    for (SpeculativeChunk& chunk : chunks) {
+        if (!resynchronize(table, data, size, start, chunk)) {
+            cerr << "Error: Invalid Huffman code" << endl;
+            return false;
+        }
+        stats.lap("resynchronize");
+        start = chunk.stop;
+        outputFile.write(chunk.text.data(), chunk.text.size());
+        decodedSize += chunk.text.size();
+        stats.lap("write");
+    }
+    stats.addBytes(size, decodedSize);
+    stats.addCount("chunks", chunks.size());
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    Stats stats;
+    bool parsed = options.parse(argc, argv, {"legacy", "mmap", "stats", "codebook"});
+    bool legacy = options.has("legacy");
+    const vector<string>& arguments = options.arguments();
+    if (!parsed || arguments.size() != (legacy ? 3u : 2u) || (legacy && options.has("codebook")) ||
+        (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+        cerr << "Usage: " << argv[0] << " [--mmap] [--codebook=FILE] [--stats=json] <encoded_file> <output_file>"
+             << endl;
+        cerr << "       " << argv[0] << " --legacy [--mmap] [--stats=json] <encoded_file> <tree_file> <output_file>"
+             << endl;
+        cerr << "       FILE the codebook the file was encoded with" << endl;
+        cerr << "       --stats=json reports phase times and counters on stderr" << endl;
         return 1;
     }
 
-    // Calculate chunk size for each process
-    encodedFile.seekg(0, ios::end);
-    size_t fileSize = encodedFile.tellg();
-    size_t start = 0;
-    size_t end = fileSize;
+    double startTime = omp_get_wtime();
+
+    bool mapped = options.has("mmap");
+    string encodedFileName = arguments.front();
+    string outputFileName = arguments.back();
 
-    // Decode binary data using Huffman Tree
-    string decodedText = decodeBinaryData(encodedFile, root, start, end);
+    // The decode table of a codebook serves every file coded with it
+    Codebook codebook;
+    bool shared = options.has("codebook");
+    if (shared && !readCodebook(options.value("codebook"), codebook)) {
+        cerr << "Error: Invalid codebook file: " << options.value("codebook") << endl;
+        return 1;
+    }
 
-    // Write decoded text to output file
-    ofstream outputFile(outputFileName);
+    ofstream outputFile(outputFileName, ios::binary);
     if (!outputFile) {
         cerr << "Error: Unable to open output file: " << outputFileName << endl;
         return 1;
     }
-    outputFile << decodedText;
-    outputFile.close();
 
-    // Release memory
-    delete root;
+    // Decode the file, writing decoded text to the output file as it goes
+    bool decoded = legacy ? decodeLegacyFile(encodedFileName, arguments[1], mapped, outputFile, stats)
+                          : decodeContainerFile(encodedFileName, mapped, shared ? &codebook : nullptr, outputFile,
+                                                stats);
+    outputFile.close();
+    stats.lap("write");
+    if (!decoded)
+        return 1;
 
     double endTime = omp_get_wtime(); // Stop measuring time
     double elapsedTime = endTime - startTime;
@@ -181,5 +236,9 @@ int main(int argc, char* argv[]) {
     cout << "Decoding completed successfully. Decoded text saved to: " << outputFileName << endl;
     cout << "Time taken: " << elapsedTime << " seconds" << endl;
 
+    stats.addCount("threads", omp_get_max_threads());
+    if (stats.isEnabled())
+        stats.writeJson(cerr, "decode_openmp", elapsedTime);
+
     return 0;
 }
@@ -1,199 +1,196 @@
 #include <iostream>
 #include <fstream>
-#include <queue>
-#include <map>
 #include <omp.h>
-#include <bitset> // Add bitset library
-#include <sstream> 
+#include <algorithm>
+#include <vector>
+
+#include "../common/codebook.h"
+#include "../common/encode.h"
+#include "../common/mapped_file.h"
+#include "../common/multi_table.h"
+#include "../common/options.h"
+#include "../common/stats.h"
 
 using namespace std;
 
 //version=1.1.3
-// Node for Huffman Tree
-struct Node {
-    char data;
-    int frequency;
-    Node* left;
-    Node* right;
-
-    Node(char data, int frequency) {
-        this->data = data;
-        this->frequency = frequency;
-        left = right = nullptr;
-    }
-};
-
-// Comparison function for priority queue
-struct compare {
-    bool operator()(Node* left, Node* right) {
-        return left->frequency > right->frequency;
+int main(int argc, char* argv[]) {
+    Options options;
+    uint64_t tableCount, maxLength, streams;
+    Stats stats;
+    if (!options.parse(argc, argv,
+                       {"stream", "mmap", "tables", "max-code-length", "interleave", "stats", "codebook"}) ||
+        options.arguments().size() != 2 || !options.number("tables", 1, tableCount) || tableCount < 1 ||
+        tableCount > MAX_CODE_TABLES || !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS ||
+        (options.has("stream") && (options.has("mmap") || tableCount > 1)) ||
+        (options.has("codebook") && tableCount > 1) ||
+        (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+        cerr << "Usage: " << argv[0] << " [--stream | [--mmap] [--tables=N]] [--codebook=FILE] [--max-code-length=L]"
+             << " [--interleave=S] [--stats=json] <input_file> <output_file>" << endl;
+        cerr << "       N code tables, 1 to " << MAX_CODE_TABLES << ", chosen per block" << endl;
+        cerr << "       codes of at most L bits, " << MIN_CODE_LENGTH_LIMIT << " to " << MAX_CODE_LENGTH_LIMIT
+             << endl;
+        cerr << "       S streams per block, 1 to " << MAX_STREAMS << ", decoded side by side" << endl;
+        cerr << "       FILE a codebook from train_codebook, used instead of counting the input; not with N > 1"
+             << endl;
+        cerr << "       --stats=json reports phase times and counters on stderr" << endl;
+        return 1;
     }
-};
-
-// Build Huffman Tree
-Node* buildHuffmanTree(std::map<char, int>& frequencies) {
-    priority_queue<Node*, vector<Node*>, compare> pq;
 
-    // Populate priority queue with leaf nodes
-    for (const auto& entry : frequencies) {
-        auto node = new Node(entry.first, entry.second);
-        pq.push(node);
-    }
+    bool stream = options.has("stream");
+    bool mapped = options.has("mmap");
+    bool shared = options.has("codebook");
+    string inputFileName = options.arguments()[0];
+    string outputFileName = options.arguments()[1];
 
-    // Combine nodes until there is only one root node left
-    while (pq.size() > 1) {
-        Node* left;
-        Node* right;
-
-        // Extract two nodes with lowest frequencies
-        #pragma omp critical
-        {
-            left = pq.top();
-            pq.pop();
-            right = pq.top();
-            pq.pop();
-        }
-
-        // Create a new node with combined frequency
-        Node* combined = new Node('\0', left->frequency + right->frequency);
-        combined->left = left;
-        combined->right = right;
-
-        // Push the combined node back to the priority queue
-        pq.push(combined);
+    Codebook codebook;
+    if (shared && !readCodebook(options.value("codebook"), codebook)) {
+        cerr << "Error: Invalid codebook file: " << options.value("codebook") << endl;
+        return 1;
     }
 
-    // Return the root of the Huffman tree
-    return pq.top();
-}
-
-// Serialize Huffman Tree and write to file
-void serializeHuffmanTree(Node* root, ofstream& outputFile) {
-    if (root == nullptr) {
-        char isNull = '0';
-        outputFile.write(&isNull, sizeof(char)); // Write null node indicator
-        return;
+    // Read input text file, all of it at once unless streaming, or map it
+    // into memory and use it in place
+    ifstream inputFile;
+    MappedFile mappedInput;
+    bool opened;
+    if (mapped) {
+        opened = mappedInput.open(inputFileName);
+    } else {
+        inputFile.open(inputFileName, ios::binary);
+        opened = inputFile.is_open();
     }
-
-    char isNotNull = '1';
-    outputFile.write(&isNotNull, sizeof(char)); // Write indicator for non-null node
-    outputFile.write(&(root->data), sizeof(char)); // Write character data
-
-    // Serialize left and right subtrees
-    serializeHuffmanTree(root->left, outputFile);
-    serializeHuffmanTree(root->right, outputFile);
-}
-
-// Traverse the Huffman Tree and assign codes to each character
-void assignHuffmanCodes(Node* root, string code, map<char, string>& codes) {
-    if (root == nullptr)
-        return;
-
-    if (root->data != '\0') {
-        codes[root->data] = code;
+    if (!opened) {
+        cerr << "Error: Unable to open input file: " << inputFileName << endl;
+        return 1;
     }
-
-    #pragma omp parallel sections
-    {
-        #pragma omp section
-        assignHuffmanCodes(root->left, code + "0", codes);
-        #pragma omp section
-        assignHuffmanCodes(root->right, code + "1", codes);
+    // Input that cannot seek, such as a pipe, has no size up front and is
+    // read until it ends
+    ContainerHeader header;
+    header.setStreams(streams);
+    vector<unsigned char> buffer;
+    const unsigned char* text = mappedInput.data();
+    uint64_t consumed = 0;
+    size_t buffered = mappedInput.size();
+    if (mapped) {
+        header.inputSize = mappedInput.size();
+    } else if (stream) {
+        header.inputSize = remainingSize(inputFile);
+        buffer.resize(streamBlockCount(header) * header.blockSize);
+        buffered = readBuffer(inputFile, buffer);
+    } else {
+        buffered = readAll(inputFile, buffer);
+        header.inputSize = buffered;
     }
-}
-
-// Encode text using Huffman codes and write to file
-void encodeText(string text, map<char, string>& codes, ofstream& outputFile) {
-    // Encode text using Huffman codes
-    string encodedText;
-    for (char c : text) {
-        if (c != '\n')
-            encodedText += codes[c];
-        else
-            encodedText += codes['~'];
+    if (!mapped)
+        text = buffer.data();
+    header.blockOffsets.assign(header.indexSize(), 0);
+    stats.lap("read");
+
+    // Busy time of each thread in the parallel phases
+    vector<double> histogramSeconds(omp_get_max_threads()), encodeSeconds(omp_get_max_threads());
+    vector<double>* histogramTimes = stats.isEnabled() ? &histogramSeconds : nullptr;
+    vector<double>* encodeTimes = stats.isEnabled() ? &encodeSeconds : nullptr;
+
+    // Calculate frequencies of characters in the text. Streaming reads the
+    // input only once, so frequencies come from the first buffer, with every
+    // byte value counted at least once so that it still has a code. The
+    // block histograms also give the blocks their offsets, so they are
+    // counted even with a codebook.
+    vector<Histogram> histograms = countBlockHistograms(text, buffered, header.blockSize, histogramTimes);
+    Histogram histogram = {};
+    if (!shared)
+        histogram = totalHistogram(histograms);
+    if (stream && !shared) {
+        for (int symbol = 0; symbol < 256; ++symbol)
+            histogram[symbol]++;
     }
-
-    // Convert binary string to bytes
-    vector<char> encodedBytes(encodedText.size() / 8 + (encodedText.size() % 8 != 0 ? 1 : 0), 0);
-    #pragma omp parallel for
-    for (size_t i = 0; i < encodedText.size(); ++i) {
-        if (encodedText[i] == '1') {
-            int byteIndex = i / 8;
-            int bitIndex = i % 8;
-            encodedBytes[byteIndex] |= (1 << (7 - bitIndex));
-        }
+    stats.lap("histogram");
+
+    // Build the Huffman code, or take it from the codebook. Canonical codes
+    // only depend on the code lengths, one for every byte value. With more
+    // than one table, every block is coded with whichever table built from
+    // the block histograms suits it best.
+    vector<CodeTable> codeTables(1);
+    if (shared) {
+        useCodebook(codebook, header);
+        codeTables[0] = codebook.codes;
+    } else {
+        header.lengths = huffmanCodeLengths(histogram, maxLength);
+        stats.lap("tree");
+        canonicalCodes(header.lengths, codeTables[0]);
     }
-
-    // Write encoded bytes to output file
-    for (size_t i = 0; i < encodedBytes.size(); ++i) {
-        outputFile.put(encodedBytes[i]);
+    stats.lap("codes");
+    if (tableCount > 1) {
+        chooseCodeTables(histograms, 0, histogram, tableCount, maxLength, [](Histogram*, unsigned) {}, header,
+                         codeTables);
+        stats.lap("tables");
     }
-}
 
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        cerr << "Usage: " << argv[0] << " <input_file> <output_file> <tree_file>" << endl;
-        return 1;
-    }
-
-    string inputFileName = argv[1];
-    string outputFileName = argv[2];
-    string treeFileName = argv[3]; // File to store Huffman tree
-
-    // Read input text file
-    ifstream inputFile(inputFileName);
-    if (!inputFile) {
-        cerr << "Error: Unable to open input file: " << inputFileName << endl;
+    // Encode text using Huffman codes and write to output file. Streaming
+    // may read the data back to move it, so the file is also open for input.
+    fstream outputFile(outputFileName, ios::in | ios::out | ios::trunc | ios::binary);
+    if (!outputFile) {
+        cerr << "Error: Unable to open output file: " << outputFileName << endl;
         return 1;
     }
 
-    // Calculate frequencies of characters in the text
-    map<char, int> frequencies;
-    char c;
-    int counter= 0;
-    while (inputFile.get(c)) {
-        if (c != '\n')
-            frequencies[c]++;
-        else
-            frequencies['~']++;        
+    // Write encoded text to output file a buffer at a time; the header is
+    // complete once all blocks are written. Until then it is sized for the
+    // expected input size, which the input may turn out to exceed.
+    uint64_t expected = header.inputSize;
+    uint64_t reserved = header.dataOffset();
+    writeHeader(outputFile, header);
+    unsigned char carry = 0;
+    uint64_t block = 0;
+    vector<unsigned char> data;
+    stats.lap("write");
+    while (buffered > 0) {
+        // Buffers hold whole blocks, so only the last block can be short
+        header.inputSize = max(header.inputSize, consumed + buffered);
+        header.blockOffsets.resize(header.indexSize());
+        encodeBlockRange(text, codeTables, histograms, header, block, carry, data, encodeTimes);
+        stats.lap("encode");
+        outputFile.write(reinterpret_cast<const char*>(data.data()), data.size());
+        stats.lap("write");
+        block += histograms.size();
+        consumed += buffered;
+        buffered = mapped ? 0 : readBuffer(inputFile, buffer);
+        stats.lap("read");
+        histograms = countBlockHistograms(text, buffered, header.blockSize, histogramTimes);
+        stats.lap("histogram");
     }
+    if (header.bitCount % 8 != 0)
+        outputFile.put(static_cast<char>(carry));
+    header.inputSize = consumed;
+    bool written = consumed >= expected &&
+                   (header.dataOffset() <= reserved ||
+                    moveBytesUp(outputFile, reserved, header.dataOffset(), header.dataSize(), buffer));
+    outputFile.seekp(0);
+    writeHeader(outputFile, header);
+
+    // Close files
     inputFile.close();
+    outputFile.close();
+    stats.lap("write");
 
-    // Build Huffman Tree
-    Node* root = buildHuffmanTree(frequencies);
-
-    // Serialize Huffman tree and write to file
-    ofstream treeFile(treeFileName, ios::binary); // Open file in binary mode
-    if (!treeFile) {
-        cerr << "Error: Unable to open Huffman tree file: " << treeFileName << endl;
-        return 1;
-    }
-    serializeHuffmanTree(root, treeFile);
-    treeFile.close();
-
-    // Assign Huffman codes to characters
-    map<char, string> codes;
-    assignHuffmanCodes(root, "", codes);
-
-    // Encode text using Huffman codes and write to output file
-    ofstream outputFile(outputFileName, ios::binary); // Open file in binary mode
-    if (!outputFile) {
-        cerr << "Error: Unable to open output file: " << outputFileName << endl;
+    if (!written) {
+        cerr << "Error: Input file shrank while encoding, or output file unreadable: " << inputFileName << endl;
         return 1;
     }
 
-    // Write encoded text to output file
-    inputFile.open(inputFileName);
-    string text((istreambuf_iterator<char>(inputFile)), istreambuf_iterator<char>());
-    encodeText(text, codes, outputFile);
-
-    // Close files and release memory
-    inputFile.close();
-    outputFile.close();
-    delete root;
-
     cout << "Compression completed successfully." << endl;
 
+    stats.addBytes(header.inputSize, header.dataOffset() + header.dataSize());
+    stats.addCount("blocks", header.blockCount());
+    stats.addCount("threads", omp_get_max_threads());
+    stats.addThreadTimes("histogram", histogramSeconds);
+    stats.addThreadTimes("encode", encodeSeconds);
+    stats.setCodeLengths(header);
+    if (stats.isEnabled())
+        stats.writeJson(cerr, "encode_openmp", stats.elapsed());
+
     return 0;
 }
-
@@ -1,144 +1,154 @@
-#include <bitset>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <vector>
 
-using namespace std;
-
-// Node for Huffman Tree
-struct Node {
-  char data;
-  Node *left;
-  Node *right;
-
-  Node(char data) {
-    this->data = data;
-    left = right = nullptr;
-  }
-};
+#include "../common/codebook.h"
+#include "../common/container.h"
+#include "../common/mapped_file.h"
+#include "../common/options.h"
+#include "../common/stats.h"
 
-// Deserialize Huffman Tree from serialized string
-Node *deserializeHuffmanTree(string &serializedTree, size_t &index) {
-  if (index >= serializedTree.size())
-    return nullptr;
-
-  if (serializedTree[index] == '0') {
-    index++;
-    return nullptr;
-  }
-
-  index++;
-  Node *root = new Node(serializedTree[index]);
-  index++;
-  root->left = deserializeHuffmanTree(serializedTree, index);
-  root->right = deserializeHuffmanTree(serializedTree, index);
-  return root;
-}
-
-// Decode text using Huffman Tree and Huffman codes
-string decodeText(string binaryString, Node *root) {
-  string decodedText = "";
-  Node *current = root;
-  for (char bit : binaryString) {
-    if (bit == '0') {
-      current = current->left;
-    } else {
-      current = current->right;
-    }
+using namespace std;
 
-    if (current->left == nullptr && current->right == nullptr) {
-      if (current->data != '~')
-        decodedText += current->data;
-      else
-        decodedText += '\n';
-      current = root;
-    }
+// Decode text using the Huffman decode tables. data holds size encoded bytes
+// from data byte dataBegin on. Returns false on an invalid code.
+bool decodeText(const unsigned char *data, size_t size, uint64_t dataBegin,
+                const ContainerHeader &header, const DecodeTables &tables,
+                uint64_t firstBlock, uint64_t lastBlock, string &decodedText) {
+  decodedText.assign(header.blockEnd(lastBlock - 1) -
+                         header.blockBegin(firstBlock),
+                     '\0');
+  if (!decodeBlocks(header, tables, data, size, dataBegin, firstBlock,
+                    lastBlock,
+                    reinterpret_cast<unsigned char *>(&decodedText[0]))) {
+    cerr << "Error: Invalid Huffman code" << endl;
+    return false;
   }
-  return decodedText;
+  return true;
 }
 
-string decodeBinaryData(ifstream &encodedFile, Node *root) {
-  string binaryString;
-  encodedFile.seekg(0, ios::end);        // Move file pointer to end of file
-  size_t fileSize = encodedFile.tellg(); // Get file size
-  encodedFile.seekg(0, ios::beg);        // Move file pointer back to beginning
+// Decode blocks [firstBlock, lastBlock), reading only the bytes holding
+// their bits
+bool decodeBinaryData(ifstream &encodedFile, const ContainerHeader &header,
+                      const DecodeTables &tables, uint64_t firstBlock,
+                      uint64_t lastBlock, string &decodedText, Stats &stats) {
+  uint64_t start = header.blockBitBegin(firstBlock) / 8;
+  uint64_t end = (header.blockBitEnd(lastBlock - 1) + 7) / 8;
+  encodedFile.seekg(header.dataOffset() + start);
 
   // Read binary data from file
-  char *buffer = new char[fileSize];
-  encodedFile.read(buffer, fileSize);
-  encodedFile.close();
-
-  // Convert binary data to binary string
-  for (size_t i = 0; i < fileSize; ++i) {
-    bitset<8> bits(buffer[i]); // Convert each byte to binary
-    binaryString += bits.to_string();
-  }
-
-  delete[] buffer;
-
-  // Find the position of the last non-zero bit
-  size_t lastNonZeroPos = binaryString.find_last_not_of('0');
-  if (lastNonZeroPos != string::npos) {
-    binaryString.resize(lastNonZeroPos + 1); // Remove trailing zeros
-  } else {
-    binaryString.clear(); // Handle case where the string is all zeros
+  vector<unsigned char> buffer(end - start);
+  if (!encodedFile.read(reinterpret_cast<char *>(buffer.data()),
+                        buffer.size())) {
+    cerr << "Error: Unable to read encoded file" << endl;
+    return false;
   }
+  stats.lap("read");
 
-  // cout <<"binaryString: ---"<<binaryString<<"---"<<endl;
-
-  // Decode binary string using Huffman Tree
-  string decodedText = decodeText(binaryString, root);
-  return decodedText;
+  // Decode packed bits using the Huffman decode tables
+  return decodeText(buffer.data(), buffer.size(), start, header, tables,
+                    firstBlock, lastBlock, decodedText);
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    cerr << "Usage: " << argv[0] << " <encoded_file> <tree_file> <output_file>"
+  Options options;
+  Stats stats;
+  if (!options.parse(argc, argv, {"mmap", "stats", "codebook"}) ||
+      options.arguments().size() != 2 ||
+      (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+    cerr << "Usage: " << argv[0] << " [--mmap] [--codebook=FILE] [--stats=json]"
+         << " <encoded_file> <output_file>" << endl;
+    cerr << "       FILE the codebook the file was encoded with" << endl;
+    cerr << "       --stats=json reports phase times and counters on stderr"
          << endl;
     return 1;
   }
 
-  string encodedFileName = argv[1];
-  string treeFileName = argv[2];
-  string outputFileName = argv[3];
+  bool mapped = options.has("mmap");
+  bool shared = options.has("codebook");
+  string encodedFileName = options.arguments()[0];
+  string outputFileName = options.arguments()[1];
 
-  // Read serialized Huffman tree
-  ifstream treeFile(treeFileName);
-  if (!treeFile) {
-    cerr << "Error: Unable to open Huffman tree file: " << treeFileName << endl;
+  // The decode table of a codebook serves every file coded with it
+  Codebook codebook;
+  if (shared && !readCodebook(options.value("codebook"), codebook)) {
+    cerr << "Error: Invalid codebook file: " << options.value("codebook")
+         << endl;
     return 1;
   }
-  string serializedTree;
-  getline(treeFile, serializedTree);
-  treeFile.close();
-
-  // Deserialize Huffman tree
-  size_t index = 0;
-  Node *root = deserializeHuffmanTree(serializedTree, index);
 
-  // Read encoded text from file
-  ifstream encodedFile(encodedFileName,
-                       ios::binary); // Open encoded file in binary mode
-  if (!encodedFile) {
+  // Read the container header and rebuild the decode tables. A mapped file
+  // is decoded in place.
+  ifstream encodedFile;
+  MappedFile mappedFile;
+  bool opened;
+  if (mapped) {
+    opened = mappedFile.open(encodedFileName);
+  } else {
+    encodedFile.open(encodedFileName,
+                     ios::binary); // Open encoded file in binary mode
+    opened = encodedFile.is_open();
+  }
+  if (!opened) {
     cerr << "Error: Unable to open encoded file: " << encodedFileName << endl;
     return 1;
   }
-  string decodedText = decodeBinaryData(encodedFile, root);
+  ContainerHeader header;
+  DecodeTables builtTables;
+  bool valid = mapped
+                   ? parseHeader(mappedFile.data(), mappedFile.size(), header)
+                   : readHeader(encodedFile, header);
+  if (!valid || (!shared && !buildDecodeTables(header, builtTables))) {
+    cerr << "Error: Invalid encoded file: " << encodedFileName << endl;
+    return 1;
+  }
+  if (shared && !codedWith(header, codebook)) {
+    cerr << "Error: Encoded file was not coded with the codebook: "
+         << encodedFileName << endl;
+    return 1;
+  }
+  const DecodeTables &tables = shared ? codebook.tables : builtTables;
+  stats.lap("parse");
 
-  // Write decoded text to output file
-  ofstream outputFile(outputFileName);
+  ofstream outputFile(outputFileName, ios::binary);
   if (!outputFile) {
     cerr << "Error: Unable to open output file: " << outputFileName << endl;
     return 1;
   }
-  outputFile << decodedText;
-  outputFile.close();
 
-  // Release memory
-  delete root;
+  // Decode and write a window of blocks at a time, so memory use does not
+  // grow with the file and output starts with the first window
+  uint64_t windowBlocks = streamBlockCount(header);
+  for (uint64_t first = 0; first < header.blockCount();
+       first += windowBlocks) {
+    uint64_t last = min(first + windowBlocks, header.blockCount());
+    string decodedText;
+    bool decoded =
+        mapped ? decodeText(mappedFile.data() + header.dataOffset(),
+                            header.dataSize(), 0, header, tables, first, last,
+                            decodedText)
+               : decodeBinaryData(encodedFile, header, tables, first, last,
+                                  decodedText, stats);
+    if (!decoded)
+      return 1;
+    stats.lap("decode");
+    outputFile.write(decodedText.data(), decodedText.size());
+    stats.lap("write");
+  }
+  encodedFile.close();
+  outputFile.close();
+  stats.lap("write");
 
   cout << "Decoding completed successfully. Decoded text saved to: "
        << outputFileName << endl;
 
+  stats.addBytes(header.dataOffset() + header.dataSize(), header.inputSize);
+  stats.addCount("blocks", header.blockCount());
+  stats.setCodeLengths(header);
+  if (stats.isEnabled())
+    stats.writeJson(cerr, "decode_serial", stats.elapsed());
+
   return 0;
 }
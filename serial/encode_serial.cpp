@@ -1,186 +1,171 @@
 #include <iostream>
 #include <fstream>
-#include <queue>
-#include <map>
-#include <bitset>
+#include <vector>
+
+#include "../common/codebook.h"
+#include "../common/encode.h"
+#include "../common/mapped_file.h"
+#include "../common/multi_table.h"
+#include "../common/options.h"
+#include "../common/stats.h"
 
 using namespace std;
 
 //version=1.1.3
-// Node for Huffman Tree
-struct Node {
-    char data;
-    int frequency;
-    Node* left;
-    Node* right;
-
-    Node(char data, int frequency) {
-        this->data = data;
-        this->frequency = frequency;
-        left = right = nullptr;
-    }
-};
-
-// Comparison function for priority queue
-struct compare {
-    bool operator()(Node* left, Node* right) {
-        return left->frequency > right->frequency;
-    }
-};
-
-// Build Huffman Tree
-Node* buildHuffmanTree(map<char, int>& frequencies) {
-    priority_queue<Node*, vector<Node*>, compare> pq;
-
-    // Populate priority queue with leaf nodes
-    for (const auto& entry : frequencies) {
-        auto node = new Node(entry.first, entry.second);
-        pq.push(node);
-    }
-
-    // Combine nodes until there is only one root node left
-    while (pq.size() > 1) {
-        Node* left = pq.top();
-        pq.pop();
-        Node* right = pq.top();
-        pq.pop();
-
-        // Create a new node with combined frequency
-        Node* combined = new Node('\0', left->frequency + right->frequency);
-        combined->left = left;
-        combined->right = right;
-
-        // Push the combined node back to the priority queue
-        pq.push(combined);
-    }
-
-    // Return the root of the Huffman tree
-    return pq.top();
-}
-
-// Serialize Huffman Tree and write to file
-void serializeHuffmanTree(Node* root, ofstream& outputFile) {
-    if (root == nullptr) {
-        outputFile << "0"; // Represent null node
-        return;
-    }
-
-    outputFile << "1" << root->data;
-    serializeHuffmanTree(root->left, outputFile);
-    serializeHuffmanTree(root->right, outputFile);
-}
-
-// Assign Huffman codes to characters
-void assignHuffmanCodes(Node* root, string code, map<char, string>& codes) {
-    if (root == nullptr)
-        return;
-
-    if (root->data != '\0') {
-        codes[root->data] = code;
-    }
-
-    assignHuffmanCodes(root->left, code + "0", codes);
-    assignHuffmanCodes(root->right, code + "1", codes);
-}
-
-void encodeText(const string& text, const map<char, string>& codes, ofstream& outputFile) {
-    // Encode text using Huffman codes
-    string encodedText;
-    for (char c : text) {
-        if (c != '\n')
-            encodedText += codes.at(c);
-        else
-            encodedText += codes.at('~');
-    }
-
-    //cout <<"encodedText: ---"<<encodedText<<"---"<<endl;
-
-    // Convert encoded text to bytes
-    vector<unsigned char> bytes;
-    int bitsRemaining = 0;
-    unsigned char currentByte = 0;
-    for (char bit : encodedText) {
-        currentByte |= (bit - '0') << (7 - bitsRemaining);
-        bitsRemaining++;
-        if (bitsRemaining == 8) {
-            bytes.push_back(currentByte);
-            currentByte = 0;
-            bitsRemaining = 0;
-        }
-    }
-    if (bitsRemaining != 0) {
-        bytes.push_back(currentByte);
+// Encode text using Huffman codes and write the container to file. With
+// more than one table, every block is coded with whichever of tableCount
+// tables built from the block histograms suits it best.
+void encodeText(const unsigned char* text, size_t n, const Histogram& histogram, unsigned tableCount,
+                unsigned maxLength, vector<CodeTable>& codes, ContainerHeader& header, ostream& outputFile,
+                Stats& stats) {
+    header.inputSize = n;
+    if (tableCount > 1) {
+        chooseCodeTables(countBlockHistograms(text, n, header.blockSize), 0, histogram, tableCount, maxLength,
+                         [](Histogram*, unsigned) {}, header, codes);
+        stats.lap("tables");
     }
-
-    // Write bytes to output file
-    outputFile.write(reinterpret_cast<const char*>(&bytes[0]), bytes.size());
+    encodeContainer(text, n, codes, header, outputFile);
+    stats.lap("encode");
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        cerr << "Usage: " << argv[0] << " <input_file> <output_file> <tree_file>" << endl;
+    Options options;
+    uint64_t tableCount, maxLength, streams;
+    Stats stats;
+    if (!options.parse(argc, argv,
+                       {"stream", "mmap", "tables", "max-code-length", "interleave", "stats", "codebook"}) ||
+        options.arguments().size() != 2 || !options.number("tables", 1, tableCount) || tableCount < 1 ||
+        tableCount > MAX_CODE_TABLES || !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT ||
+        !options.number("interleave", 1, streams) || streams < 1 || streams > MAX_STREAMS ||
+        (options.has("stream") && (options.has("mmap") || tableCount > 1)) ||
+        (options.has("codebook") && tableCount > 1) ||
+        (options.has("stats") && !statsOption(options.value("stats"), stats))) {
+        cerr << "Usage: " << argv[0] << " [--stream | [--mmap] [--tables=N]] [--codebook=FILE] [--max-code-length=L]"
+             << " [--interleave=S] [--stats=json] <input_file> <output_file>" << endl;
+        cerr << "       N code tables, 1 to " << MAX_CODE_TABLES << ", chosen per block" << endl;
+        cerr << "       codes of at most L bits, " << MIN_CODE_LENGTH_LIMIT << " to " << MAX_CODE_LENGTH_LIMIT
+             << endl;
+        cerr << "       S streams per block, 1 to " << MAX_STREAMS << ", decoded side by side" << endl;
+        cerr << "       FILE a codebook from train_codebook, used instead of counting the input; not with N > 1"
+             << endl;
+        cerr << "       --stats=json reports phase times and counters on stderr" << endl;
         return 1;
     }
 
-    string inputFileName = argv[1];
-    string outputFileName = argv[2];
-    string treeFileName = argv[3]; // File to store Huffman tree
+    // With a codebook nothing is counted, so the input is read only once
+    bool shared = options.has("codebook");
+    bool mapped = options.has("mmap");
+    bool stream = options.has("stream") || (shared && !mapped);
+    string inputFileName = options.arguments()[0];
+    string outputFileName = options.arguments()[1];
 
-    // Read input text file
-    ifstream inputFile(inputFileName);
-    if (!inputFile) {
-        cerr << "Error: Unable to open input file: " << inputFileName << endl;
+    Codebook codebook;
+    if (shared && !readCodebook(options.value("codebook"), codebook)) {
+        cerr << "Error: Invalid codebook file: " << options.value("codebook") << endl;
         return 1;
     }
-    
-
-    // Calculate frequencies of characters in the text
-    map<char, int> frequencies;
-    char c;
-    int counter= 0;
-    while (inputFile.get(c)) {
-        if (c != '\n')
-            frequencies[c]++;
-        else
-            frequencies['~']++;
-    }
-    inputFile.close();
-
-    // Build Huffman Tree
-    Node* root = buildHuffmanTree(frequencies);
 
-    // Serialize Huffman tree and write to file
-    ofstream treeFile(treeFileName);
-    if (!treeFile) {
-        cerr << "Error: Unable to open Huffman tree file: " << treeFileName << endl;
+    // Read input text file, or map it into memory
+    ifstream inputFile;
+    MappedFile mappedInput;
+    bool opened;
+    if (mapped) {
+        opened = mappedInput.open(inputFileName);
+    } else {
+        inputFile.open(inputFileName, ios::binary);
+        opened = inputFile.is_open();
+    }
+    if (!opened) {
+        cerr << "Error: Unable to open input file: " << inputFileName << endl;
         return 1;
     }
-    serializeHuffmanTree(root, treeFile);
-    treeFile.close();
 
-    // Assign Huffman codes to characters
-    map<char, string> codes;
-    assignHuffmanCodes(root, "", codes);
+    ContainerHeader header;
+    header.setStreams(streams);
+
+    // Calculate frequencies of characters in the text. Streaming reads the
+    // input only once, so frequencies come from the first buffer, with every
+    // byte value counted at least once so that it still has a code.
+    // Otherwise the whole input is read once and kept for encoding. Input
+    // that cannot seek, such as a pipe, has no size up front and is read
+    // until it ends.
+    Histogram histogram = {};
+    vector<unsigned char> buffer;
+    size_t buffered = 0;
+    if (stream) {
+        header.inputSize = remainingSize(inputFile);
+        buffer.resize(streamBlockCount(header) * header.blockSize);
+        buffered = readBuffer(inputFile, buffer);
+        stats.lap("read");
+        if (!shared) {
+            histogram.fill(1);
+            countBytes(buffer.data(), buffered, histogram.data());
+        }
+    } else if (shared) {
+        // The codebook holds the codes
+    } else if (mapped) {
+        stats.lap("read");
+        countBytes(mappedInput.data(), mappedInput.size(), histogram.data());
+    } else {
+        buffered = readAll(inputFile, buffer);
+        inputFile.close();
+        stats.lap("read");
+        countBytes(buffer.data(), buffered, histogram.data());
+    }
+    stats.lap("histogram");
+
+    // Build the Huffman code, or take it from the codebook. Canonical codes
+    // only depend on the code lengths, one for every byte value.
+    vector<CodeTable> codeTables(1);
+    if (shared) {
+        useCodebook(codebook, header);
+        codeTables[0] = codebook.codes;
+    } else {
+        header.lengths = huffmanCodeLengths(histogram, maxLength);
+        stats.lap("tree");
+        canonicalCodes(header.lengths, codeTables[0]);
+    }
+    stats.lap("codes");
 
-    // Encode text using Huffman codes and write to output file
-    ofstream outputFile(outputFileName, ios::binary); // Open output file in binary mode
+    // Encode text using Huffman codes and write to output file. Streaming
+    // may read the data back to move it, so the file is also open for input.
+    fstream outputFile(outputFileName, ios::in | ios::out | ios::trunc | ios::binary);
     if (!outputFile) {
         cerr << "Error: Unable to open output file: " << outputFileName << endl;
         return 1;
     }
 
-    // Read input text file again
-    inputFile.open(inputFileName);
-    string text((istreambuf_iterator<char>(inputFile)), istreambuf_iterator<char>());
-    encodeText(text, codes, outputFile);
+    if (stream) {
+        // Encode and write a buffer at a time
+        if (!encodeStreamContainer(inputFile, buffer, buffered, codeTables[0], header, outputFile)) {
+            cerr << "Error: Input file shrank while encoding, or output file unreadable: " << inputFileName << endl;
+            return 1;
+        }
+        stats.lap("encode");
+    } else if (mapped) {
+        // Encode straight from the mapped input
+        encodeText(mappedInput.data(), mappedInput.size(), histogram, tableCount, maxLength, codeTables, header,
+                   outputFile, stats);
+    } else {
+        // Encode the input read above
+        encodeText(buffer.data(), buffered, histogram, tableCount, maxLength, codeTables, header, outputFile, stats);
+    }
 
-    // Close files and release memory
+    // Close files
     inputFile.close();
     outputFile.close();
-    delete root;
+    stats.lap("write");
 
     cout << "Compression completed successfully." << endl;
 
+    // The encoder writes as it encodes, so most writing counts as encoding
+    stats.addBytes(header.inputSize, header.dataOffset() + header.dataSize());
+    stats.addCount("blocks", header.blockCount());
+    stats.setCodeLengths(header);
+    if (stats.isEnabled())
+        stats.writeJson(cerr, "encode_serial", stats.elapsed());
+
     return 0;
 }
 
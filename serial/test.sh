@@ -1,9 +1,9 @@
 #!/bin/bash
-#SBATCH --time=00:05:00
+#SBATCH --time=00:15:00
 #SBATCH --account=mcs
 
-bash -c "g++ -std=c++11 encode_serial.cpp -o encode_serial" &>/dev/null
-bash -c "g++ -std=c++11 decode_serial.cpp -o decode_serial" &>/dev/null
+bash -c "g++ -std=c++11 -O2 encode_serial.cpp -o encode_serial" &>/dev/null
+bash -c "g++ -std=c++11 -O2 decode_serial.cpp -o decode_serial" &>/dev/null
 
 echo -e ">>>> Serial Algorithm Time Analysis >>>>"
 
@@ -11,34 +11,44 @@ N=10
 M=$((5 * 2 * 2 * 2 * 2 * 2))
 file1=text_sample.txt
 file2=input.txt
-
-for ((i = 1; i <= 32 * 2 * 2 * 2 * 2 * 2 * 2; i += 1)); do
-	cat $file1 >>$file2
+chunk=chunk.txt
+
+# Milliseconds since the epoch, and MB/s for a byte count and milliseconds
+ms() { echo $(($(date +%s%N) / 1000000)); }
+mbps() { awk -v b="$1" -v t="$2" 'BEGIN { if (t > 0) printf "%.1f", b / t / 1000; else print "-" }'; }
+
+# Build the input by doubling instead of appending one copy at a time:
+# 32 * 2^6 copies of the sample, then M copies more per step
+cp $file1 $file2
+for ((i = 1; i <= 11; i += 1)); do
+	cat $file2 $file2 >$chunk
+	mv $chunk $file2
 done
+for ((j = 1; j <= M; j += 1)); do
+	cat $file1
+done >$chunk
 
 for ((i = 0; i <= 6; i += 1)); do
-	for ((j = 1; j <= M; j += 1)); do
-		cat $file1 >>$file2
-	done
+	cat $chunk >>$file2
 done
 
 for ((i = 1; i <= N; i += 1)); do
-	for ((j = 1; j <= M; j += 1)); do
-		cat $file1 >>$file2
-	done
+	cat $chunk >>$file2
 
 	numChars=$(wc -c "./${file2}")
-	t1=$(date +%s)
-	./encode_serial "./${file2}" ./output.bin ./huffman_tree.txt
-	t2=$(date +%s)
-	secs=$((t2 - t1))
-	echo -e "N = ${numChars} -> Encode seconds run = ${secs}"
+	t1=$(ms)
+	./encode_serial "./${file2}" ./output.bin
+	t2=$(ms)
+	msecs=$((t2 - t1))
+	echo -e "N = ${numChars} -> Encode milliseconds run = ${msecs} ($(mbps "${numChars% *}" ${msecs}) MB/s)"
 
 	numBytes=$(wc -c ./output.bin)
-	t1=$(date +%s)
-	./decode_serial ./output.bin ./huffman_tree.txt plain.txt
-	t2=$(date +%s)
-	secs=$((t2 - t1))
-	echo -e "N = ${numBytes} -> Decode seconds run = ${secs}"
+	t1=$(ms)
+	./decode_serial ./output.bin plain.txt
+	t2=$(ms)
+	msecs=$((t2 - t1))
+	echo -e "N = ${numBytes} -> Decode milliseconds run = ${msecs} ($(mbps "${numChars% *}" ${msecs}) MB/s)"
 	echo -e "--"
 done
+
+rm -f $chunk
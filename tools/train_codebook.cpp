@@ -0,0 +1,58 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/codebook.h"
+#include "../common/mapped_file.h"
+#include "../common/options.h"
+
+using namespace std;
+
+// Train a shared codebook on sample files and save it, for the encoders'
+// --codebook option. The code lengths come from the byte frequencies of
+// all the samples together, with every byte value counted once more so
+// that inputs holding bytes the samples lack still encode.
+int main(int argc, char* argv[]) {
+    Options options;
+    uint64_t maxLength;
+    if (!options.parse(argc, argv, {"max-code-length"}) || options.arguments().size() < 2 ||
+        !options.number("max-code-length", MAX_CODE_LENGTH_LIMIT, maxLength) ||
+        maxLength < MIN_CODE_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH_LIMIT) {
+        cerr << "Usage: " << argv[0] << " [--max-code-length=L] <codebook_file> <sample_file> ..." << endl;
+        cerr << "       codes of at most L bits, " << MIN_CODE_LENGTH_LIMIT << " to " << MAX_CODE_LENGTH_LIMIT
+             << endl;
+        return 1;
+    }
+
+    const vector<string>& arguments = options.arguments();
+    string codebookFileName = arguments[0];
+
+    // Count the bytes of every sample
+    Histogram histogram = {};
+    uint64_t sampleBytes = 0;
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        MappedFile sample;
+        if (!sample.open(arguments[i])) {
+            cerr << "Error: Unable to open sample file: " << arguments[i] << endl;
+            return 1;
+        }
+        countBytes(sample.data(), sample.size(), histogram.data());
+        sampleBytes += sample.size();
+    }
+
+    Codebook codebook;
+    if (!setCodebookLengths(trainCodebook(histogram, static_cast<unsigned>(maxLength)), codebook) ||
+        !writeCodebook(codebookFileName, codebook.lengths)) {
+        cerr << "Error: Unable to write codebook file: " << codebookFileName << endl;
+        return 1;
+    }
+
+    // How well the codebook fits the samples themselves
+    uint64_t bits = encodedBits(histogram.data(), codebook.codes);
+    cout << "Codebook " << hex << setw(16) << setfill('0') << codebook.id << dec << " saved to: " << codebookFileName
+         << endl;
+    cout << "Samples: " << sampleBytes << " bytes, " << fixed << setprecision(3)
+         << (sampleBytes ? static_cast<double>(bits) / sampleBytes : 0.0) << " bits per byte" << endl;
+    return 0;
+}